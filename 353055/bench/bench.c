@@ -0,0 +1,681 @@
+// Microbenchmarks of the transaction manager, run with ./bench <name> [threads] (or ./bench all)
+
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE   200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "tm.h"
+
+#define MAX_WRITE_SET 4096
+
+#define BANK_ACCOUNTS 256
+#define BANK_TX_PER_THREAD 100000
+#define BANK_INIT_BALANCE 100
+#define BANK_LONG_EVERY 16 // one long read-only transaction every that many transactions
+
+static int bench_threads = 4; // second command line argument
+
+static double nowNs(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// Commit time of a transaction that reads then writes n words, while another transaction commits in between.
+// The concurrent commit forces the read set to be validated against the write set.
+static double commitTime(shared_t r, size_t n, int reps){
+    char* start = (char*)tm_start(r);
+    char* other = start + MAX_WRITE_SET * 8; // word written by the interfering transaction
+    long buffer = 0;
+    double total = 0;
+    for(int rep = 0; rep < reps; rep++){
+        tx_t t = tm_begin(r, false);
+        for(size_t i = 0; i < n; i++){
+            if(!tm_read(r, t, start + 8 * i, 8, &buffer))
+                return -1;
+            buffer++;
+            if(!tm_write(r, t, &buffer, 8, start + 8 * i))
+                return -1;
+        }
+        tx_t t2 = tm_begin(r, false);
+        if(!tm_write(r, t2, &buffer, 8, other) || !tm_end(r, t2))
+            return -1;
+        double before = nowNs();
+        bool committed = tm_end(r, t);
+        total += nowNs() - before;
+        if(!committed)
+            return -1;
+    }
+    return total / reps;
+}
+
+static void benchWriteSet(void){
+    shared_t r = tm_create((MAX_WRITE_SET + 8) * 8, 8);
+    printf("write-set size, commit time (ns), commit time per word (ns)\n");
+    for(size_t n = 1; n <= MAX_WRITE_SET; n *= 2){
+        int reps = n < 256 ? 2000 : 200;
+        double ns = commitTime(r, n, reps);
+        if(ns < 0){
+            printf("%zu, aborted\n", n);
+            continue;
+        }
+        printf("%zu, %.0f, %.1f\n", n, ns, ns / n);
+    }
+    tm_destroy(r);
+}
+
+typedef struct BankResult{
+    double seconds;
+    unsigned long commits;
+    unsigned long aborts;
+    unsigned long ro_aborts; // aborts of the long read-only scans
+    bool consistent;
+}BankResult;
+
+typedef struct BankWorker{
+    shared_t r;
+    unsigned int seed;
+    unsigned long commits;
+    unsigned long aborts;
+    unsigned long ro_aborts;
+    bool consistent;
+}BankWorker;
+
+// Sums all the accounts in a read-only transaction, false if the transaction aborted
+static bool bankSum(shared_t r, long* sum){
+    char* accounts = (char*)tm_start(r);
+    tx_t t = tm_begin(r, true);
+    *sum = 0;
+    for(size_t i = 0; i < BANK_ACCOUNTS; i++){
+        long balance;
+        if(!tm_read(r, t, accounts + 8 * i, 8, &balance))
+            return false;
+        *sum += balance;
+    }
+    return tm_end(r, t);
+}
+
+static bool bankTransfer(shared_t r, size_t from, size_t to){
+    char* accounts = (char*)tm_start(r);
+    tx_t t = tm_begin(r, false);
+    long sender, receiver;
+    if(!tm_read(r, t, accounts + 8 * from, 8, &sender))
+        return false;
+    if(sender <= 0)
+        return tm_end(r, t);
+    sender--;
+    if(!tm_write(r, t, &sender, 8, accounts + 8 * from))
+        return false;
+    // read after the write, so that a transfer to the same account reads its own write
+    if(!tm_read(r, t, accounts + 8 * to, 8, &receiver))
+        return false;
+    receiver++;
+    if(!tm_write(r, t, &receiver, 8, accounts + 8 * to))
+        return false;
+    return tm_end(r, t);
+}
+
+static void* bankWorker(void* arg){
+    BankWorker* worker = (BankWorker*)arg;
+    worker->consistent = true;
+    for(int i = 0; i < BANK_TX_PER_THREAD; i++){
+        if(i % BANK_LONG_EVERY == 0){
+            long sum;
+            while(!bankSum(worker->r, &sum)){
+                worker->aborts++;
+                worker->ro_aborts++;
+            }
+            if(sum != (long)BANK_ACCOUNTS * BANK_INIT_BALANCE)
+                worker->consistent = false;
+        }
+        else{
+            size_t from = rand_r(&(worker->seed)) % BANK_ACCOUNTS;
+            size_t to = rand_r(&(worker->seed)) % BANK_ACCOUNTS;
+            while(!bankTransfer(worker->r, from, to))
+                worker->aborts++;
+        }
+        worker->commits++;
+    }
+    return NULL;
+}
+
+// Bank-style transfers and balance scans over accounts stored in the first segment
+static BankResult runBank(int threads){
+    BankResult result = {0, 0, 0, 0, true};
+    shared_t r = tm_create(BANK_ACCOUNTS * 8, 8);
+    if(r == invalid_shared){
+        result.consistent = false;
+        return result;
+    }
+    char* accounts = (char*)tm_start(r);
+    tx_t t = tm_begin(r, false);
+    long balance = BANK_INIT_BALANCE;
+    for(size_t i = 0; i < BANK_ACCOUNTS; i++)
+        tm_write(r, t, &balance, 8, accounts + 8 * i);
+    tm_end(r, t);
+
+    BankWorker* workers = (BankWorker*)calloc(threads, sizeof(BankWorker));
+    pthread_t* ids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+    double before = nowNs();
+    for(int i = 0; i < threads; i++){
+        workers[i].r = r;
+        workers[i].seed = 42 + i;
+        pthread_create(&ids[i], NULL, bankWorker, &workers[i]);
+    }
+    for(int i = 0; i < threads; i++){
+        pthread_join(ids[i], NULL);
+        result.commits += workers[i].commits;
+        result.aborts += workers[i].aborts;
+        result.ro_aborts += workers[i].ro_aborts;
+        result.consistent = result.consistent && workers[i].consistent;
+    }
+    result.seconds = (nowNs() - before) / 1e9;
+    free(ids);
+    free(workers);
+    tm_destroy(r);
+    return result;
+}
+
+static void printBank(const char* label, int threads, BankResult result){
+    printf("%s, %d, %.3f, %.0f, %.4f, %lu%s\n", label, threads, result.seconds, result.commits / result.seconds,
+        (double)result.aborts / (result.commits + result.aborts), result.ro_aborts, result.consistent ? "" : ", INCONSISTENT");
+}
+
+// False conflicts against lock metadata, the library reports metadata bytes on stderr (TM_STATS)
+static void benchLocks(void){
+    static const char* const modes[] = {"word", "stripe", "table"};
+    setenv("TM_STATS", "1", 1);
+    printf("locks, threads, seconds, tx/s, abort ratio, read-only aborts\n");
+    for(size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++){
+        setenv("TM_LOCKS", modes[i], 1);
+        printBank(modes[i], bench_threads, runBank(bench_threads));
+        fflush(stdout);
+    }
+    unsetenv("TM_LOCKS");
+    unsetenv("TM_STATS");
+}
+
+// Engines on the bank mix, from 1 thread up to the requested number of threads
+static void benchEngines(void){
+    static const char* const engines[] = {"tl2", "mv", "norec", "etl"};
+    printf("engine, threads, seconds, tx/s, abort ratio, read-only aborts\n");
+    for(int threads = 1; threads <= bench_threads; threads *= 2){
+        for(size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++){
+            setenv("TM_ENGINE", engines[i], 1);
+            printBank(engines[i], threads, runBank(threads));
+            fflush(stdout);
+        }
+    }
+    unsetenv("TM_ENGINE");
+}
+
+// Contention managers on the bank mix, the library reports kills and waits on stderr (TM_STATS)
+static void benchContention(void){
+    static const char* const policies[] = {"suicide", "backoff", "karma", "greedy", "timestamp"};
+    setenv("TM_STATS", "1", 1);
+    printf("cm, threads, seconds, tx/s, abort ratio, read-only aborts\n");
+    for(size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++){
+        setenv("TM_CM", policies[i], 1);
+        printBank(policies[i], bench_threads, runBank(bench_threads));
+        fflush(stdout);
+    }
+    unsetenv("TM_CM");
+    unsetenv("TM_STATS");
+}
+
+#define CLOCK_TX_PER_THREAD 200000
+
+typedef struct ClockWorker{
+    shared_t r;
+    char* word; // private to the worker, on a cache line of its own
+    unsigned long aborts;
+}ClockWorker;
+
+static void* clockWorker(void* arg){
+    ClockWorker* worker = (ClockWorker*)arg;
+    for(int i = 0; i < CLOCK_TX_PER_THREAD; i++){
+        while(true){
+            long value;
+            tx_t t = tm_begin(worker->r, false);
+            if(tm_read(worker->r, t, worker->word, 8, &value)){
+                value++;
+                if(tm_write(worker->r, t, &value, 8, worker->word) && tm_end(worker->r, t))
+                    break;
+            }
+            worker->aborts++;
+        }
+    }
+    return NULL;
+}
+
+// Clock schemes, on transactions that never conflict: every commit still goes through the global clock
+static void benchClock(void){
+    static const char* const schemes[] = {"gv1", "gv4", "gv5", "gv6"};
+    printf("clock, threads, seconds, tx/s, abort ratio\n");
+    for(int threads = 1; threads <= bench_threads; threads *= 2){
+        for(size_t i = 0; i < sizeof(schemes) / sizeof(schemes[0]); i++){
+            setenv("TM_CLOCK", schemes[i], 1);
+            shared_t r = tm_create((size_t)threads * 64, 8);
+            if(r == invalid_shared)
+                continue;
+            ClockWorker* workers = (ClockWorker*)calloc(threads, sizeof(ClockWorker));
+            pthread_t* ids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+            double before = nowNs();
+            for(int j = 0; j < threads; j++){
+                workers[j].r = r;
+                workers[j].word = (char*)tm_start(r) + 64 * j;
+                pthread_create(&ids[j], NULL, clockWorker, &workers[j]);
+            }
+            unsigned long aborts = 0;
+            for(int j = 0; j < threads; j++){
+                pthread_join(ids[j], NULL);
+                aborts += workers[j].aborts;
+            }
+            double seconds = (nowNs() - before) / 1e9;
+            unsigned long commits = (unsigned long)threads * CLOCK_TX_PER_THREAD;
+            printf("%s, %d, %.3f, %.0f, %.4f\n", schemes[i], threads, seconds, commits / seconds, (double)aborts / (commits + aborts));
+            fflush(stdout);
+            free(ids);
+            free(workers);
+            tm_destroy(r);
+        }
+    }
+    unsetenv("TM_CLOCK");
+}
+
+#define ALLOC_TX 200000
+
+// Transactions that allocate a segment and free the one allocated by the previous transaction, i.e. tm_alloc and
+// the release of freed segments, with the descriptor's slab pool and without it (TM_POOL_BYTES=0)
+static void benchAlloc(void){
+    static const size_t sizes[] = {64, 512, 4096, 65536};
+    static const char* const pools[] = {"0", "4194304"};
+    printf("pool bytes, segment size, ns per transaction\n");
+    for(size_t p = 0; p < sizeof(pools) / sizeof(pools[0]); p++){
+        setenv("TM_POOL_BYTES", pools[p], 1);
+        for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++){
+            shared_t r = tm_create(64, 8);
+            if(r == invalid_shared)
+                continue;
+            void* previous = NULL;
+            double before = nowNs();
+            for(int j = 0; j < ALLOC_TX; j++){
+                void* segment;
+                tx_t t = tm_begin(r, false);
+                if(tm_alloc(r, t, sizes[i], &segment) != success_alloc || (previous && !tm_free(r, t, previous)) || !tm_end(r, t)){
+                    printf("%s, %zu, failed\n", pools[p], sizes[i]);
+                    break;
+                }
+                previous = segment;
+            }
+            printf("%s, %zu, %.1f\n", pools[p], sizes[i], (nowNs() - before) / ALLOC_TX);
+            fflush(stdout);
+            tm_destroy(r);
+        }
+    }
+    unsetenv("TM_POOL_BYTES");
+}
+
+#define LAYOUT_WORDS ((size_t)1 << 23) // 64 MiB of words, far larger than the caches
+#define LAYOUT_TX 200000
+#define LAYOUT_READS 16
+
+// Read-write transactions that read words at random in a large segment and write one of them, i.e. mostly cache
+// misses, with the locks apart from the words (word, stripe) or inline with them
+static void benchLayout(void){
+    static const char* const modes[] = {"word", "stripe", "inline"};
+    printf("locks, ns per transaction, ns per read\n");
+    for(size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++){
+        setenv("TM_LOCKS", modes[i], 1);
+        shared_t r = tm_create(LAYOUT_WORDS * 8, 8);
+        if(r == invalid_shared)
+            continue;
+        char* start = (char*)tm_start(r);
+        unsigned long seed = 42;
+        double before = nowNs();
+        for(int j = 0; j < LAYOUT_TX; j++){
+            while(true){
+                long sum = 0, value;
+                size_t word = 0;
+                tx_t t = tm_begin(r, false);
+                bool ok = true;
+                for(int k = 0; k < LAYOUT_READS && ok; k++){
+                    seed = seed * 6364136223846793005ul + 1442695040888963407ul;
+                    word = (seed >> 20) % LAYOUT_WORDS;
+                    ok = tm_read(r, t, start + 8 * word, 8, &value);
+                    sum += value;
+                }
+                sum++;
+                if(ok && tm_write(r, t, &sum, 8, start + 8 * word) && tm_end(r, t))
+                    break;
+            }
+        }
+        double ns = (nowNs() - before) / LAYOUT_TX;
+        printf("%s, %.1f, %.1f\n", modes[i], ns, ns / LAYOUT_READS);
+        fflush(stdout);
+        tm_destroy(r);
+    }
+    unsetenv("TM_LOCKS");
+}
+
+#define SCAN_WORDS 4096
+#define SCAN_TX 20000
+
+// Transactions that read a whole range with a single tm_read, with each implementation of the batched path (TM_SIMD)
+static void benchScan(void){
+    static const char* const levels[] = {"off", "scalar", "sse", "avx2"};
+    long* buffer = (long*)malloc(SCAN_WORDS * sizeof(long));
+    printf("simd, read-only ns per word, read-write ns per word\n");
+    for(size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++){
+        setenv("TM_SIMD", levels[i], 1);
+        shared_t r = tm_create(SCAN_WORDS * 8, 8);
+        if(r == invalid_shared)
+            continue;
+        double ns[2];
+        for(int ro = 1; ro >= 0; ro--){
+            double before = nowNs();
+            for(int j = 0; j < SCAN_TX; j++){
+                tx_t t = tm_begin(r, ro);
+                if(!tm_read(r, t, tm_start(r), SCAN_WORDS * 8, buffer) || !tm_end(r, t))
+                    printf("%s: aborted\n", levels[i]);
+            }
+            ns[ro] = (nowNs() - before) / SCAN_TX / SCAN_WORDS;
+        }
+        printf("%s, %.2f, %.2f\n", levels[i], ns[1], ns[0]);
+        fflush(stdout);
+        tm_destroy(r);
+    }
+    unsetenv("TM_SIMD");
+    free(buffer);
+}
+
+#define VALIDATE_MAX_READS 65536
+#define VALIDATE_WORDS ((size_t)1 << 24) // the reads are spread over 128 MiB of words
+#define VALIDATE_REPS 8
+#define FLUSH_BYTES ((size_t)256 << 20) // written between the reads and the commit, to evict the locks from the caches
+
+// Commit time of a transaction that read n random words one by one and writes one, after another transaction
+// committed: the commit validates the whole read set, with each implementation of the batched validation (TM_SIMD).
+// The caches are flushed before the commit, so that validation misses on every lock as it would on a busy machine.
+static void benchValidate(void){
+    static const char* const levels[] = {"off", "scalar", "sse", "avx2"};
+    char* flush = (char*)malloc(FLUSH_BYTES);
+    printf("simd, read-set size, commit time (ns), ns per read\n");
+    for(size_t i = 0; i < sizeof(levels) / sizeof(levels[0]) && flush; i++){
+        setenv("TM_SIMD", levels[i], 1);
+        shared_t r = tm_create((VALIDATE_WORDS + 8) * 8, 8);
+        if(r == invalid_shared)
+            continue;
+        char* start = (char*)tm_start(r);
+        char* other = start + VALIDATE_WORDS * 8;
+        unsigned long seed = 42;
+        for(size_t n = 64; n <= VALIDATE_MAX_READS; n *= 4){
+            int reps = VALIDATE_REPS;
+            double total = 0;
+            long value = 0;
+            for(int rep = 0; rep < reps; rep++){
+                tx_t t = tm_begin(r, false);
+                for(size_t j = 0; j < n; j++){
+                    seed = seed * 6364136223846793005ul + 1442695040888963407ul;
+                    tm_read(r, t, start + 8 * ((seed >> 20) % VALIDATE_WORDS), 8, &value);
+                }
+                tm_write(r, t, &value, 8, start);
+                tx_t t2 = tm_begin(r, false);
+                if(!tm_write(r, t2, &value, 8, other) || !tm_end(r, t2))
+                    return;
+                memset(flush, rep, FLUSH_BYTES);
+                double before = nowNs();
+                tm_end(r, t);
+                total += nowNs() - before;
+            }
+            printf("%s, %zu, %.0f, %.2f\n", levels[i], n, total / reps, total / reps / n);
+            fflush(stdout);
+        }
+        tm_destroy(r);
+    }
+    unsetenv("TM_SIMD");
+    free(flush);
+}
+
+#define FILTER_READS 4096
+#define FILTER_TX 2000
+
+// Read-write transactions that write n words, then read words they did not write one by one: every read checks
+// the write set's signature first. The words read hold no zero byte, the last word of the segment excepted.
+static void benchFilter(void){
+    printf("write-set size, ns per read\n");
+    shared_t r = tm_create((MAX_WRITE_SET + FILTER_READS + 1) * 8, 8);
+    if(r == invalid_shared)
+        return;
+    char* start = (char*)tm_start(r);
+    long pattern = 0x0101010101010101l;
+    tx_t fill = tm_begin(r, false);
+    for(size_t k = 0; k < FILTER_READS; k++)
+        tm_write(r, fill, &pattern, 8, start + 8 * (MAX_WRITE_SET + k));
+    tm_end(r, fill);
+    for(size_t n = 1; n <= MAX_WRITE_SET; n *= 4){
+        double total = 0;
+        for(int j = 0; j < FILTER_TX; j++){
+            long value = j;
+            tx_t t = tm_begin(r, false);
+            for(size_t k = 0; k < n; k++)
+                tm_write(r, t, &value, 8, start + 8 * k);
+            double before = nowNs();
+            for(size_t k = 0; k < FILTER_READS; k++)
+                tm_read(r, t, start + 8 * (MAX_WRITE_SET + k), 8, &value);
+            total += nowNs() - before;
+            tm_end(r, t);
+        }
+        printf("%zu, %.2f\n", n, total / FILTER_TX / FILTER_READS);
+        fflush(stdout);
+    }
+    tm_destroy(r);
+}
+
+#define WRITEBACK_MAX 65536
+
+// Commit time of transactions that write n words of a range in a random order (then in order, for reference)
+static void benchWriteBack(void){
+    size_t* order = (size_t*)malloc(WRITEBACK_MAX * sizeof(size_t));
+    shared_t r = tm_create(WRITEBACK_MAX * 8, 8);
+    if(!order || r == invalid_shared)
+        return;
+    char* start = (char*)tm_start(r);
+    unsigned long seed = 42;
+    printf("words, shuffled commit ns per word, sequential commit ns per word\n");
+    for(size_t n = 64; n <= WRITEBACK_MAX; n *= 4){
+        int reps = (int)(WRITEBACK_MAX * 4 / n);
+        double ns[2] = {0, 0};
+        for(int shuffled = 1; shuffled >= 0; shuffled--){
+            for(int rep = 0; rep < reps; rep++){
+                for(size_t k = 0; k < n; k++)
+                    order[k] = k;
+                for(size_t k = n - 1; shuffled && k > 0; k--){
+                    seed = seed * 6364136223846793005ul + 1442695040888963407ul;
+                    size_t other = (seed >> 20) % (k + 1), word = order[k];
+                    order[k] = order[other];
+                    order[other] = word;
+                }
+                long value = rep;
+                tx_t t = tm_begin(r, false);
+                for(size_t k = 0; k < n; k++)
+                    tm_write(r, t, &value, 8, start + 8 * order[k]);
+                double before = nowNs();
+                tm_end(r, t);
+                ns[shuffled] += nowNs() - before;
+            }
+        }
+        printf("%zu, %.2f, %.2f\n", n, ns[1] / reps / n, ns[0] / reps / n);
+        fflush(stdout);
+    }
+    tm_destroy(r);
+    free(order);
+}
+
+#define WORDS_TX 20000
+#define WORDS_PER_TX 64
+
+// Time of single-word reads and writes, for each word size (a read and a write of every word, then the commit)
+static void benchWords(void){
+    static const size_t aligns[] = {1, 2, 4, 8, 16, 64};
+    char value[64] = {0};
+    printf("word size, ns per read, ns per write\n");
+    for(size_t a = 0; a < sizeof(aligns) / sizeof(aligns[0]); a++){
+        size_t align = aligns[a];
+        shared_t r = tm_create(WORDS_PER_TX * align, align);
+        if(r == invalid_shared)
+            return;
+        char* start = (char*)tm_start(r);
+        double reads = 0, writes = 0;
+        for(int j = 0; j < WORDS_TX; j++){
+            tx_t t = tm_begin(r, false);
+            double before = nowNs();
+            for(size_t k = 0; k < WORDS_PER_TX; k++)
+                tm_read(r, t, start + k * align, align, value);
+            double middle = nowNs();
+            for(size_t k = 0; k < WORDS_PER_TX; k++)
+                tm_write(r, t, value, align, start + k * align);
+            writes += nowNs() - middle;
+            reads += middle - before;
+            tm_end(r, t);
+        }
+        printf("%zu, %.2f, %.2f\n", align, reads / WORDS_TX / WORDS_PER_TX, writes / WORDS_TX / WORDS_PER_TX);
+        fflush(stdout);
+        tm_destroy(r);
+    }
+}
+
+#define HOT_WORDS 4
+#define HOT_TX_PER_THREAD 200000
+
+typedef struct HotWorker{
+    shared_t r;
+    unsigned long seed;
+    unsigned long aborts;
+}HotWorker;
+
+// Blind writes of two of a few hot words: the only conflicts are on the commit locks
+static void* hotWorker(void* arg){
+    HotWorker* worker = (HotWorker*)arg;
+    char* start = (char*)tm_start(worker->r);
+    for(long i = 0; i < HOT_TX_PER_THREAD; i++){
+        worker->seed = worker->seed * 6364136223846793005ul + 1442695040888963407ul;
+        size_t first = (worker->seed >> 33) % HOT_WORDS, second = (first + 1 + (worker->seed >> 40) % (HOT_WORDS - 1)) % HOT_WORDS;
+        while(true){
+            tx_t t = tm_begin(worker->r, false);
+            if(tm_write(worker->r, t, &i, 8, start + 8 * first) && tm_write(worker->r, t, &i, 8, start + 8 * second) && tm_end(worker->r, t))
+                break;
+            worker->aborts++;
+        }
+    }
+    return NULL;
+}
+
+static void benchHotSpot(void){
+    printf("threads, seconds, tx/s, abort ratio\n");
+    for(int threads = 1; threads <= bench_threads; threads *= 2){
+        shared_t r = tm_create(HOT_WORDS * 8, 8);
+        if(r == invalid_shared)
+            return;
+        HotWorker* workers = (HotWorker*)calloc(threads, sizeof(HotWorker));
+        pthread_t* ids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+        double before = nowNs();
+        for(int j = 0; j < threads; j++){
+            workers[j].r = r;
+            workers[j].seed = 42 + j;
+            pthread_create(&ids[j], NULL, hotWorker, &workers[j]);
+        }
+        unsigned long aborts = 0;
+        for(int j = 0; j < threads; j++){
+            pthread_join(ids[j], NULL);
+            aborts += workers[j].aborts;
+        }
+        double seconds = (nowNs() - before) / 1e9;
+        unsigned long commits = (unsigned long)threads * HOT_TX_PER_THREAD;
+        printf("%d, %.3f, %.0f, %.4f\n", threads, seconds, commits / seconds, (double)aborts / (commits + aborts));
+        fflush(stdout);
+        free(ids);
+        free(workers);
+        tm_destroy(r);
+    }
+}
+
+#define REREAD_TX 2000
+
+// With the etl engine, reads of a range the transaction wrote part of (every other word), after the writes
+static void benchReread(void){
+    long* buffer = (long*)calloc(SCAN_WORDS, sizeof(long));
+    setenv("TM_ENGINE", "etl", 1);
+    shared_t r = tm_create(SCAN_WORDS * 8, 8);
+    unsetenv("TM_ENGINE");
+    if(!buffer || r == invalid_shared)
+        return;
+    char* start = (char*)tm_start(r);
+    printf("words written, ns per word read\n");
+    for(size_t stride = SCAN_WORDS; stride >= 1; stride /= 8){
+        double total = 0;
+        for(int j = 0; j < REREAD_TX; j++){
+            tx_t t = tm_begin(r, false);
+            for(size_t k = 0; k < SCAN_WORDS; k += stride)
+                tm_write(r, t, &buffer[k], 8, start + 8 * k);
+            double before = nowNs();
+            if(!tm_read(r, t, start, SCAN_WORDS * 8, buffer) || !tm_end(r, t))
+                printf("aborted\n");
+            total += nowNs() - before;
+        }
+        printf("%zu, %.2f\n", SCAN_WORDS / stride, total / REREAD_TX / SCAN_WORDS);
+        fflush(stdout);
+    }
+    tm_destroy(r);
+    free(buffer);
+}
+
+typedef struct Benchmark{
+    const char* name;
+    void (*run)(void);
+}Benchmark;
+
+static const Benchmark benchmarks[] = {
+    {"writeset", benchWriteSet},
+    {"locks", benchLocks},
+    {"engines", benchEngines},
+    {"cm", benchContention},
+    {"clock", benchClock},
+    {"alloc", benchAlloc},
+    {"layout", benchLayout},
+    {"scan", benchScan},
+    {"validate", benchValidate},
+    {"filter", benchFilter},
+    {"writeback", benchWriteBack},
+    {"words", benchWords},
+    {"hotspot", benchHotSpot},
+    {"reread", benchReread},
+};
+
+int main(int argc, char** argv){
+    const char* name = argc > 1 ? argv[1] : "all";
+    if(argc > 2)
+        bench_threads = atoi(argv[2]) > 0 ? atoi(argv[2]) : bench_threads;
+    bool found = false;
+    for(size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++){
+        if(strcmp(name, "all") == 0 || strcmp(name, benchmarks[i].name) == 0){
+            printf("== %s ==\n", benchmarks[i].name);
+            benchmarks[i].run();
+            found = true;
+        }
+    }
+    if(!found){
+        printf("Usage: %s [all", argv[0]);
+        for(size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+            printf("|%s", benchmarks[i].name);
+        printf("]\n");
+        return 1;
+    }
+    return 0;
+}
@@ -1,53 +1,94 @@
 #pragma once
 
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
 #include "data_structures.h"
-#include "stdbool.h"
+#include "macros.h"
+
+// Blocked Bloom filter over the words of the write set, so that reads of words the transaction never wrote skip the
+// write set lookup. A word is hashed once (multiplicative 64-bit hash of its segment and number), which picks one
+// 64-bit word of the signature and two bits in it: a lookup is a single load and mask. The signature starts as a
+// single word and doubles, rebuilt from the write log, whenever it holds more than one word per BLOOM_BITS_PER_ENTRY
+// bits, which keeps false positives around 5%. Clearing it only goes back to the first word.
+
+#define BLOOM_INITIAL_CAPACITY 8
+#define BLOOM_MAX_WORDS 4096
+#define BLOOM_BITS_PER_ENTRY 8
+
+static inline uint64_t bloomHash(const SegmentNode* segment, uint32_t word_num){
+    return ((uint64_t)(uintptr_t)segment + ((uint64_t)word_num << 3)) * 0x9E3779B97F4A7C15ull;
+}
 
-BloomFilter* initialiseBloomFilter(size_t size, size_t num_hashes) {
+// Word of the signature for the hash and the two bits the address sets in it
+static inline uint64_t* bloomWord(const BloomFilter* filter, uint64_t hash, uint64_t* mask){
+    *mask = (1ull << (hash >> 58)) | (1ull << ((hash >> 52) & 63));
+    return &(filter->words[(hash >> 32) & (filter->num_words - 1)]);
+}
+
+BloomFilter* initialiseBloomFilter(void) {
     BloomFilter* filter = (BloomFilter*)malloc(sizeof(BloomFilter));
     if (!filter) {
         return NULL;
     }
-
-    filter->size = size;
-    filter->bit_array = (uint8_t*)calloc((size + 7) / 8, sizeof(uint8_t)); // making sure we don't floor by /7, allow for padding
-    if (!filter->bit_array) {
+    filter->words = (uint64_t*)calloc(BLOOM_INITIAL_CAPACITY, sizeof(uint64_t));
+    if (!filter->words) {
         free(filter);
         return NULL;
     }
-    filter->num_hashes = num_hashes;
-
+    filter->capacity = BLOOM_INITIAL_CAPACITY;
+    filter->num_words = 1;
+    filter->entries = 0;
     return filter;
 }
 
-uint32_t hashFunction(const char* address, size_t seed) {
-    uint32_t hash = 42 + seed;
-    while (*address != '\0') {
-        hash = (hash << 5) + hash + *address++;
+// Doubles the signature and adds every address of the write log again (if it cannot grow, it just gets fuller)
+static void growBloomFilter(BloomFilter* filter, const WriteLog* writes) {
+    uint32_t num_words = 2 * filter->num_words;
+    if (num_words > filter->capacity) {
+        uint64_t* words = (uint64_t*)realloc(filter->words, num_words * sizeof(uint64_t));
+        if (unlikely(!words))
+            return;
+        filter->words = words;
+        filter->capacity = num_words;
+    }
+    filter->num_words = num_words;
+    memset(filter->words, 0, num_words * sizeof(uint64_t));
+    for (uint32_t i = 0; i < writes->size; i++) {
+        const WriteEntry* entry = &(writes->entries[i]);
+        for (uint32_t k = 0; k < entry->count; k++) {
+            uint64_t mask;
+            *bloomWord(filter, bloomHash(entry->segment, entry->word_num + k), &mask) |= mask;
+        }
     }
-    return hash;
 }
 
-void addToBloomFilter(BloomFilter* filter, const char* address) {
-    for (int i = 0; i < filter->num_hashes; ++i) {
-        uint32_t hash = hashFunction(address, i) % filter->size;
-        filter->bit_array[hash / 8] |= (1 << (hash % 8));
-    }
+// Adds a word just appended to the write log
+void addToBloomFilter(BloomFilter* filter, const WriteLog* writes, const SegmentNode* segment, uint32_t word_num) {
+    uint64_t mask;
+    *bloomWord(filter, bloomHash(segment, word_num), &mask) |= mask;
+    filter->entries++;
+    if (unlikely(filter->entries * BLOOM_BITS_PER_ENTRY > filter->num_words * 64) && filter->num_words < BLOOM_MAX_WORDS)
+        growBloomFilter(filter, writes);
 }
 
-bool isInBloomFilter(const BloomFilter* filter, const char* address) {
-    for (int i = 0; i < filter->num_hashes; ++i) {
-        uint32_t hash = hashFunction(address, i) % filter->size;
-        if ((filter->bit_array[hash / 8] & (1 << (hash % 8))) == 0) {
-            return false; // One of the bits is not set
-        }
-    }
-    return true; // All bits are set
+static inline bool isInBloomFilter(const BloomFilter* filter, const SegmentNode* segment, uint32_t word_num) {
+    uint64_t mask;
+    return (*bloomWord(filter, bloomHash(segment, word_num), &mask) & mask) == mask;
+}
+
+void clearBloomFilter(BloomFilter* filter) {
+    filter->num_words = 1;
+    filter->words[0] = 0;
+    filter->entries = 0;
 }
 
 void freeBloomFilter(BloomFilter* filter) {
     assert(filter);
-    assert(filter->bit_array);
-    free(filter->bit_array);
+    assert(filter->words);
+    free(filter->words);
     free(filter);
-}
\ No newline at end of file
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdatomic.h>
+
+#include "data_structures.h"
+#include "macros.h"
+
+// Global clock schemes (TM_CLOCK), i.e. how a committer picks its write version wv once it holds its locks.
+// In every scheme wv is larger than the clock the committer reads after locking, which is what makes a
+// reader that sampled its rv before we locked see either our locks or our committed values, never a mix.
+//  - gv1: fetch_add, every commit advances the clock.
+//  - gv4: a single CAS, a committer that loses it shares the winner's version instead of retrying.
+//  - gv5: wv = clock + 1 without writing it, versions run ahead of the clock. A transaction that finds a version
+//         past its rv moves the clock up to it (observeVersion), otherwise its retries would find it again.
+//  - gv6: adaptive, gv5 while the clock's lag goes unnoticed, gv4 for the next GV6_PERIOD versions after a
+//         transaction had to move the clock up, so that writers stop running ahead of readers.
+// With gv5 and gv6 versions are not unique, so the read set is always validated.
+
+#define GV6_PERIOD 32
+
+// Write version of a committer that holds all its locks, *skip_validation tells whether no commit can have
+// happened since the transaction's rv
+uint64_t commitVersion(MemoryRegion* region, Transaction* t, bool* skip_validation){
+    _Atomic uint64_t* clock = &(region->global_clock);
+    *skip_validation = false;
+    switch(region->config.clock){
+        case CLOCK_GV4:{
+            uint64_t old = atomic_load(clock);
+            if(atomic_compare_exchange_strong(clock, &old, old + 1)){
+                *skip_validation = old == t->rv;
+                return old + 1;
+            }
+            return old; // the version installed by the committer that won, larger than what we read
+        }
+        case CLOCK_GV6:{
+            uint64_t old = atomic_load(clock);
+            if(old >= atomic_load_explicit(&(region->clock_eager_until), memory_order_relaxed))
+                return old + 1;
+            if(atomic_compare_exchange_strong(clock, &old, old + 1))
+                return old + 1;
+            return old;
+        }
+        case CLOCK_GV5:
+            return atomic_load(clock) + 1;
+        default:{
+            uint64_t wv = atomic_fetch_add(clock, 1) + 1;
+            *skip_validation = wv == t->rv + 1;
+            return wv;
+        }
+    }
+}
+
+// Moves the clock up to a version a transaction found past its rv (gv5, gv6)
+void observeVersion(MemoryRegion* region, uint64_t version){
+    if(region->config.clock != CLOCK_GV5 && region->config.clock != CLOCK_GV6)
+        return;
+    uint64_t now = atomic_load_explicit(&(region->global_clock), memory_order_relaxed);
+    while(now < version && !atomic_compare_exchange_weak(&(region->global_clock), &now, version));
+    if(region->config.clock == CLOCK_GV6 && atomic_load_explicit(&(region->clock_eager_until), memory_order_relaxed) < version + GV6_PERIOD)
+        atomic_store_explicit(&(region->clock_eager_until), version + GV6_PERIOD, memory_order_relaxed);
+}
+
+// Version for locks released by an abort: larger than the version they had, so that readers see them change
+uint64_t freshVersion(MemoryRegion* region, uint64_t version){
+    uint64_t fresh = atomic_fetch_add(&(region->global_clock), 1) + 1;
+    return fresh > version ? fresh : version + 1; // with gv5 and gv6, the lock's version may be ahead of the clock
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "data_structures.h"
+
+// Options of a shared memory region (RegionConfig) are fixed when the region is created.
+// tm_create has no room for options, so each one can be overridden through an environment variable.
+
+#define STRIPE_BYTES 64
+#define DEFAULT_OREC_BITS 20
+#define MAX_OREC_BITS 28
+#define DEFAULT_MV_VERSIONS 16
+#define DEFAULT_IRREVOCABLE_AFTER 8
+#define DEFAULT_POOL_BYTES (4L << 20)
+
+// Snapshot extension levels, read-only transactions have to log their reads to extend
+#define EXTEND_NEVER      0
+#define EXTEND_READ_WRITE 1
+#define EXTEND_ALL        2
+
+static const char* const engine_names[] = {"tl2", "mv", "norec", "etl"};
+static const char* const lock_mode_names[] = {"word", "stripe", "table", "inline", "none"};
+static const char* const clock_names[] = {"gv1", "gv4", "gv5", "gv6"};
+static const char* const simd_names[] = {"auto", "off", "scalar", "sse", "avx2"};
+static const char* const cm_names[] = {"suicide", "backoff", "karma", "greedy", "timestamp"};
+
+// Index of the value of the environment variable in choices, or default_choice if unset or unknown
+int envChoice(const char* name, const char* const* choices, int num_choices, int default_choice){
+    const char* value = getenv(name);
+    if(!value)
+        return default_choice;
+    for(int i = 0; i < num_choices; i++){
+        if(strcmp(value, choices[i]) == 0)
+            return i;
+    }
+    return default_choice;
+}
+
+long envNumber(const char* name, long default_value, long min_value, long max_value){
+    const char* value = getenv(name);
+    if(!value || !*value)
+        return default_value;
+    char* end;
+    long number = strtol(value, &end, 10);
+    if(*end != '\0' || number < min_value || number > max_value)
+        return default_value;
+    return number;
+}
+
+void loadRegionConfig(RegionConfig* config){
+    config -> engine = (Engine) envChoice("TM_ENGINE", engine_names, 4, ENGINE_TL2);
+    config -> mv_versions = (uint32_t) envNumber("TM_MV_VERSIONS", DEFAULT_MV_VERSIONS, 1, 1 << 20);
+    config -> locks = (LockMode) envChoice("TM_LOCKS", lock_mode_names, 4, LOCKS_WORD);
+    config -> orec_bits = (uint32_t) envNumber("TM_OREC_BITS", DEFAULT_OREC_BITS, 1, MAX_OREC_BITS);
+    config -> clock = (ClockScheme) envChoice("TM_CLOCK", clock_names, 4, CLOCK_GV1);
+    config -> extend = (uint32_t) envNumber("TM_EXTEND", EXTEND_READ_WRITE, EXTEND_NEVER, EXTEND_ALL);
+    config -> cm = (CmPolicy) envChoice("TM_CM", cm_names, 5, CM_BACKOFF);
+    config -> irrevocable_after = (uint32_t) envNumber("TM_IRREVOCABLE", DEFAULT_IRREVOCABLE_AFTER, 0, UINT32_MAX);
+    config -> simd = (SimdLevel) envChoice("TM_SIMD", simd_names, 5, SIMD_AUTO);
+    config -> pool_bytes = (size_t) envNumber("TM_POOL_BYTES", DEFAULT_POOL_BYTES, 0, 1L << 40);
+    config -> stats = envNumber("TM_STATS", 0, 0, 1) == 1;
+    if(config->engine == ENGINE_MV)
+        config -> locks = LOCKS_WORD; // a version chain relies on its word's lock version being the word's own
+    if(config->engine == ENGINE_NOREC)
+        config -> locks = LOCKS_NONE;
+    if(config->engine == ENGINE_MV || config->engine == ENGINE_NOREC)
+        config -> clock = CLOCK_GV1; // version intervals need unique versions, and the norec clock is a sequence lock
+}
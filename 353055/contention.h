@@ -0,0 +1,238 @@
+#pragma once
+
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "data_structures.h"
+#include "versioned_lock.h"
+#include "macros.h"
+
+// Contention manager (TM_CM): decides what a transaction does when it finds a word locked by another one,
+// either reading it or trying to lock it at commit. It may wait for the lock, abort itself, or kill the owner.
+//
+// Only a transaction that has not started writing back can be killed. Once it holds all its locks, a committer
+// moves itself from TX_ACTIVE to TX_COMMITTING, while a killer moves it from TX_ACTIVE to TX_KILLED: the first
+// CAS wins. A killed transaction notices when it next waits or tries to commit, and then releases its locks.
+// Every wait is bounded, so two transactions waiting on each other both end up aborting. A wait lasts up to the
+// descriptor's spin limit, which doubles (up to CM_SPINS_MAX) when owners release later than half of it and halves
+// (down to CM_SPINS_MIN) when a wait times out: short waits where locks are held briefly, longer ones otherwise.
+// A committing owner holds all its locks and never waits itself, so waiting on it cannot close a cycle; such
+// waits do not count towards CM_MAX_WAITS (whatever the policy but suicide).
+//
+// A transaction that aborted irrevocable_after times in a row runs irrevocably: it takes the region's serial
+// token, waits for the running read-write transactions to finish, and new ones wait at begin until it is done.
+// With no other writer, none of its reads or locks can conflict, so it commits. Read-only transactions keep
+// running alongside. Writers publish their status before checking the token, and the irrevocable transaction
+// takes the token before checking the statuses (both sequentially consistent), so at least one sees the other.
+
+#define CM_SPINS_PER_WAIT 256     // initial spin limit of a wait
+#define CM_SPINS_MIN 32
+#define CM_SPINS_MAX 4096
+#define CM_SPINS_BEFORE_YIELD 32
+#define CM_MAX_WAITS 16           // conflicts waited on by an attempt before it aborts itself
+#define CM_BACKOFF_MAX_EXP 12     // the backoff after n consecutive aborts is random in [0, 2^min(n, max)) spins
+
+static inline void cpuRelax(void){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static inline Transaction* descriptorById(MemoryRegion* region, uint32_t id){
+    if(unlikely(id == 0 || id > MAX_DESCRIPTORS))
+        return NULL;
+    return atomic_load_explicit(&(region->descriptors[id - 1]), memory_order_acquire);
+}
+
+static inline bool cmKilled(Transaction* t){
+    return atomic_load_explicit(&(t->cm.status), memory_order_acquire) == TX_KILLED;
+}
+
+// Rank of the running attempt: karma grows with the work done, timestamps are fixed on the first attempt
+static inline uint64_t cmOwnPriority(MemoryRegion* region, Transaction* t){
+    if(region->config.cm == CM_KARMA)
+        return t->cm.karma + t->logs.reads.words + t->logs.writes.words + t->cm.waits;
+    return atomic_load_explicit(&(t->cm.priority), memory_order_relaxed);
+}
+
+// Publishes a read-write transaction as running, unless an irrevocable one is, in which case it waits for it
+static void enterAsWriter(MemoryRegion* region, Transaction* t){
+    while(true){
+        atomic_store(&(t->cm.status), TX_ACTIVE);
+        if(likely(atomic_load(&(region->serial_token)) == 0))
+            return;
+        atomic_store(&(t->cm.status), TX_IDLE);
+        for(uint32_t spins = 1; atomic_load_explicit(&(region->serial_token), memory_order_relaxed) != 0; spins++){
+            if(spins % CM_SPINS_BEFORE_YIELD == 0)
+                sched_yield();
+            else
+                cpuRelax();
+        }
+    }
+}
+
+static void becomeIrrevocable(MemoryRegion* region, Transaction* t){
+    uint32_t expected = 0;
+    for(uint32_t spins = 1; !atomic_compare_exchange_weak(&(region->serial_token), &expected, t->id); spins++){
+        expected = 0;
+        if(spins % CM_SPINS_BEFORE_YIELD == 0)
+            sched_yield();
+        else
+            cpuRelax();
+    }
+    atomic_store(&(t->cm.status), TX_IRREVOCABLE);
+    // drain the writers that were already running, they are either committing or about to abort
+    unsigned int count = atomic_load(&(region->num_descriptors));
+    for(unsigned int i = 0; i < count && i < MAX_DESCRIPTORS; i++){
+        Transaction* other = atomic_load(&(region->descriptors[i]));
+        if(!other || other == t)
+            continue;
+        for(uint32_t spins = 1; ; spins++){
+            uint32_t status = atomic_load(&(other->cm.status));
+            if(status == TX_IDLE || status == TX_READ_ONLY)
+                break;
+            if(spins % CM_SPINS_BEFORE_YIELD == 0)
+                sched_yield();
+            else
+                cpuRelax();
+        }
+    }
+    t->stats.irrevocable++;
+}
+
+// Called before the transaction samples its snapshot, an irrevocable transaction must only see the clock once writers are drained
+void cmBegin(MemoryRegion* region, Transaction* t){
+    t->cm.waits = 0;
+    if(t->cm.consecutive_aborts == 0){
+        // a new transaction rather than the retry of an aborted one
+        t->cm.karma = 0;
+        uint64_t priority = 0;
+        if(region->config.cm == CM_GREEDY || region->config.cm == CM_TIMESTAMP)
+            priority = UINT64_MAX - atomic_fetch_add_explicit(&(region->cm_ticket), 1, memory_order_relaxed);
+        atomic_store_explicit(&(t->cm.priority), priority, memory_order_relaxed);
+    }
+    if(unlikely(region->config.irrevocable_after != 0 && t->cm.consecutive_aborts >= region->config.irrevocable_after))
+        becomeIrrevocable(region, t);
+    else if(t->is_ro)
+        atomic_store_explicit(&(t->cm.status), TX_READ_ONLY, memory_order_relaxed);
+    else
+        enterAsWriter(region, t);
+}
+
+// Publishes the rank a committer holds its locks with, before it takes them
+void cmPublish(MemoryRegion* region, Transaction* t){
+    if(region->config.cm == CM_KARMA)
+        atomic_store_explicit(&(t->cm.priority), cmOwnPriority(region, t), memory_order_relaxed);
+}
+
+// Called with every lock held, false if the transaction was killed in the meantime
+bool cmStartCommit(Transaction* t){
+    uint32_t expected = TX_ACTIVE;
+    if(atomic_compare_exchange_strong(&(t->cm.status), &expected, TX_COMMITTING))
+        return true;
+    return expected == TX_IRREVOCABLE;
+}
+
+// Ends the transaction's run, handing back the serial token if it held it
+static inline void cmLeave(MemoryRegion* region, Transaction* t){
+    if(unlikely(atomic_load_explicit(&(t->cm.status), memory_order_relaxed) == TX_IRREVOCABLE)){
+        atomic_store(&(t->cm.status), TX_IDLE);
+        atomic_store(&(region->serial_token), 0);
+        return;
+    }
+    atomic_store(&(t->cm.status), TX_IDLE);
+}
+
+static inline void cmKill(Transaction* t, Transaction* victim){
+    uint32_t expected = TX_ACTIVE;
+    if(atomic_compare_exchange_strong(&(victim->cm.status), &expected, TX_KILLED))
+        t->stats.kills++;
+}
+
+// Waits for the lock word to change, false if the transaction got killed meanwhile
+static bool cmWait(Transaction* t, VersionedLock* lock, uint64_t seen){
+    atomic_store_explicit(&(t->cm.waiting), true, memory_order_relaxed);
+    bool alive = true;
+    uint32_t limit = t->cm.spin_limit, spins = 1;
+    for(; spins <= limit; spins++){
+        if(resampleLock(lock) != seen)
+            break;
+        if(cmKilled(t)){
+            alive = false;
+            break;
+        }
+        if(spins % CM_SPINS_BEFORE_YIELD == 0)
+            sched_yield(); // the owner may be waiting for this core
+        else
+            cpuRelax();
+    }
+    if(spins > limit)
+        t -> cm.spin_limit = limit / 2 > CM_SPINS_MIN ? limit / 2 : CM_SPINS_MIN;
+    else if(alive && 2 * spins > limit)
+        t -> cm.spin_limit = 2 * limit < CM_SPINS_MAX ? 2 * limit : CM_SPINS_MAX;
+    atomic_store_explicit(&(t->cm.waiting), false, memory_order_relaxed);
+    return alive;
+}
+
+// Called on finding lock locked (value seen) by another transaction.
+// Returns true if the caller should sample the lock again, false if it should abort.
+bool cmResolve(MemoryRegion* region, Transaction* t, VersionedLock* lock, uint64_t seen){
+    CmPolicy policy = region->config.cm;
+    if(unlikely(atomic_load_explicit(&(t->cm.status), memory_order_relaxed) == TX_IRREVOCABLE))
+        return cmWait(t, lock, seen); // only a writer from before the token can hold it, and it is finishing
+    if(policy == CM_SUICIDE || cmKilled(t))
+        return false;
+    Transaction* owner = descriptorById(region, lockOwner(seen));
+    uint32_t status = owner ? atomic_load(&(owner->cm.status)) : TX_COMMITTING;
+    if(status != TX_COMMITTING){
+        if(t->cm.waits >= CM_MAX_WAITS)
+            return false;
+        t->cm.waits++;
+    }
+    // a committing owner cannot be stopped and is about to release, whatever the policy
+    if(policy != CM_BACKOFF && status == TX_ACTIVE){
+        uint64_t mine = cmOwnPriority(region, t);
+        uint64_t theirs = atomic_load_explicit(&(owner->cm.priority), memory_order_relaxed);
+        bool wins = mine > theirs || (mine == theirs && t->id < owner->id);
+        if(policy == CM_GREEDY && atomic_load_explicit(&(owner->cm.waiting), memory_order_relaxed))
+            wins = true; // an owner that is waiting itself does not make progress
+        if(wins)
+            cmKill(t, owner); // then wait for it to release
+        else if(policy == CM_TIMESTAMP)
+            return false;
+    }
+    t->stats.waits++;
+    return cmWait(t, lock, seen);
+}
+
+// Randomized exponential backoff, so that transactions that keep conflicting do not retry in lockstep
+static void cmBackoff(Transaction* t){
+    uint32_t exp = t->cm.consecutive_aborts < CM_BACKOFF_MAX_EXP ? t->cm.consecutive_aborts : CM_BACKOFF_MAX_EXP;
+    // xorshift
+    uint32_t x = t->cm.seed ? t->cm.seed : t->id * 2654435761u;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    t->cm.seed = x;
+    uint32_t spins = x & ((1u << exp) - 1);
+    for(uint32_t i = 1; i <= spins; i++){
+        if(i % CM_SPINS_BEFORE_YIELD == 0)
+            sched_yield();
+        else
+            cpuRelax();
+    }
+}
+
+// Called before the logs of the aborted attempt are cleared
+void cmAbort(MemoryRegion* region, Transaction* t){
+    cmLeave(region, t);
+    t->cm.consecutive_aborts++;
+    t->cm.karma += t->logs.reads.words + t->logs.writes.words;
+    if(region->config.cm == CM_BACKOFF)
+        cmBackoff(t);
+}
+
+void cmCommit(MemoryRegion* region, Transaction* t){
+    cmLeave(region, t);
+    t->cm.consecutive_aborts = 0;
+}
@@ -4,16 +4,97 @@
 #include <stdatomic.h>
 #include <pthread.h>
 
+#include "versioned_lock.h"
+
+
+#define MAX_DESCRIPTORS 1024 // maximum number of transaction descriptors per region, i.e. of concurrent transactions
+#define CACHE_LINE_BYTES 64
+
+// Virtual addresses, see segment_directory.h
+#define SEGMENT_SHIFT 40 // bits of the offset in a segment, the remaining 24 bits number the segment
+#define DIRECTORY_LEAF_BITS 12
+#define DIRECTORY_LEAF_SIZE ((size_t)1 << DIRECTORY_LEAF_BITS)
+#define DIRECTORY_TOP_SIZE ((size_t)1 << (64 - SEGMENT_SHIFT - DIRECTORY_LEAF_BITS))
+#define MAX_SEGMENTS (DIRECTORY_TOP_SIZE * DIRECTORY_LEAF_SIZE)
+#define POOL_MIN_SHIFT 6 // smallest slab size class, 64 bytes
+#define POOL_CLASSES 15  // slabs of up to 2^(POOL_MIN_SHIFT + POOL_CLASSES - 1) bytes are recycled
+#define NO_SIZE_CLASS UINT8_MAX
+
+struct Transaction;
+
+// Options of a shared memory region, see config.h
+typedef enum Engine{
+    ENGINE_TL2, // TL2, commit-time locking with a redo log
+    ENGINE_MV,  // TL2 with version chains, read-only transactions read a snapshot and never abort
+    ENGINE_NOREC, // NOrec, a global sequence lock and value-based validation, no per-word metadata
+    ENGINE_ETL,   // encounter-time locking, writes in place with an undo log
+}Engine;
+
+typedef enum LockMode{
+    LOCKS_WORD,   // one lock per word, stored with the segment
+    LOCKS_STRIPE, // one lock per cache line of the segment
+    LOCKS_TABLE,  // fixed-size global table of ownership records, words mapped by hash
+    LOCKS_INLINE, // one lock per cache line of the segment, stored in the line itself before its words (align 8 only)
+    LOCKS_NONE,   // no per-word lock at all (norec engine), not selectable
+}LockMode;
+
+typedef enum CmPolicy{
+    CM_SUICIDE,   // abort on any conflict, the caller retries right away
+    CM_BACKOFF,   // wait a bit for the lock, then abort and back off exponentially before returning
+    CM_KARMA,     // the transaction that did the most work, accumulated over its retries, wins
+    CM_GREEDY,    // the oldest transaction wins, younger ones wait for it unless it is waiting itself
+    CM_TIMESTAMP, // the oldest transaction wins, younger ones abort at once
+}CmPolicy;
+
+typedef enum ClockScheme{
+    CLOCK_GV1, // fetch_add on every commit
+    CLOCK_GV4, // single CAS, losers share the winner's version
+    CLOCK_GV5, // commits do not write the clock, transactions that see a version past their rv advance it
+    CLOCK_GV6, // gv5, but committers advance the clock for a while once transactions find it lagging
+}ClockScheme;
+
+typedef enum SimdLevel{
+    SIMD_AUTO,   // best instruction set the CPU supports
+    SIMD_OFF,    // multi-word reads and validation go one word at a time
+    SIMD_SCALAR, // batched, without vector instructions
+    SIMD_SSE,    // SSE4.2 at most
+    SIMD_AVX2,
+}SimdLevel;
+
+// Lock checks of batched multi-word reads and of read set validation, one implementation per instruction set
+// (see vector_scan.h)
+typedef struct LockScanner{
+    const char* name;
+    bool (*scan)(VersionedLock* locks, size_t n, uint64_t rv, uint32_t owner, uint64_t* sampled);
+    bool (*same)(VersionedLock* locks, size_t n, const uint64_t* sampled);
+    bool (*valid)(const uint64_t* sampled, size_t n, uint64_t rv, uint32_t owner);
+}LockScanner;
+
+typedef struct RegionConfig{
+    Engine engine;      // TM_ENGINE=tl2|mv|norec|etl
+    uint32_t mv_versions; // TM_MV_VERSIONS, bound on the old versions kept per word (mv engine)
+    LockMode locks;     // TM_LOCKS=word|stripe|table|inline
+    uint32_t orec_bits; // TM_OREC_BITS, the global table has 2^orec_bits records
+    ClockScheme clock;  // TM_CLOCK=gv1|gv4|gv5|gv6
+    uint32_t extend;    // TM_EXTEND, snapshot extension: 0 never (abort on a too recent version), 1 read-write transactions, 2 all
+    CmPolicy cm;        // TM_CM=suicide|backoff|karma|greedy|timestamp
+    uint32_t irrevocable_after; // TM_IRREVOCABLE, consecutive aborts before a transaction runs irrevocably, 0 never
+    SimdLevel simd;     // TM_SIMD=auto|off|scalar|sse|avx2
+    size_t pool_bytes;  // TM_POOL_BYTES, bound on the freed slabs each descriptor keeps for its allocations, 0 never keeps any
+    bool stats;         // TM_STATS=1 prints statistics when the region is destroyed
+}RegionConfig;
 
 // Every memory location (some unit) should have a lock that has a lock bit and a lock version number
 // This version number denotes the last timestamp at which the data was written to
 
 
+// Signature of the addresses a transaction wrote, see bloom_filter.h
 typedef struct BloomFilter
 {
-    size_t size;
-    int num_hashes;
-    uint8_t* bit_array;
+    uint64_t* words;    // the first num_words are in use
+    uint32_t num_words; // power of two, grows with the write set
+    uint32_t capacity;  // words allocated
+    uint32_t entries;   // addresses added since the filter was cleared
 }BloomFilter;
 
 
@@ -27,49 +108,216 @@ typedef struct RWLock
 }RWLock;
 
 
+// Old value of a word, current for the versions in [valid_from, end)
+typedef struct VersionNode{
+    uint64_t valid_from;
+    uint64_t end;
+    _Atomic(struct VersionNode*) next; // older version
+    char value[];
+}VersionNode;
+
+// A segment is a single slab: this header, then its locks, its words and their version chains (see segment_pool.h)
 typedef struct SegmentNode {
     struct SegmentNode* prev;
-    struct SegmentNode* next;
+    struct SegmentNode* next; // next free slab of the same class in a descriptor's pool
     size_t size;
     void* segment_start; // actual segment where the reads and writes happen
     uint32_t num_words;
-    atomic_bool* lock_bit; // each word has a lock bit
-    uint32_t* lock_version_number; // each word lock has a version number denoting the last timestamp when it was written to
+    uint8_t size_class; // the slab holds 2^(POOL_MIN_SHIFT + size_class) bytes, NO_SIZE_CLASS if it is not recycled
+    uint64_t id; // segment number, also used to spread segments over the global lock table
+    VersionedLock* locks; // lock(s) with a version number denoting the last timestamp when the words were written to, NULL in table mode
+    _Atomic(VersionNode*)* versions; // per word, newest old version first (mv engine only)
 } SegmentNode;
 
+typedef _Atomic(SegmentNode*) SegmentSlot;
+
 
 typedef struct MemoryRegion{
-	atomic_long global_clock; // global clock for TL2
+    // The clock is written by every committer, it gets a cache line of its own (the region is allocated aligned to it)
+    _Alignas(CACHE_LINE_BYTES) _Atomic uint64_t global_clock; // global clock for TL2, sequence lock for NOrec (odd while a writer commits)
+    _Atomic uint64_t clock_eager_until; // gv6 committers advance the clock until it reaches this value
+    char clock_padding[CACHE_LINE_BYTES - 2 * sizeof(uint64_t)];
 	void* start_segment; // pointer to non-deallocable first segment
-    struct SegmentNode** segments_list; // at the ith position, ith alloced segment
-    size_t num_allocs; // use this for the naming convention
-    size_t max_size;
-    // RWLock allocation_lock; // since (de)allocations can happen concurrently
-    pthread_mutex_t allocation_lock; // since (de)allocations can happen concurrently
+    _Atomic(SegmentSlot*) segment_directory[DIRECTORY_TOP_SIZE]; // leaves of DIRECTORY_LEAF_SIZE slots, the ith slot holds the ith alloced segment
+    _Atomic size_t num_allocs; // next segment number, reserved by (de)allocations running concurrently
     size_t size;        // Size of the non-deallocable memory segment (in bytes)
     size_t align;       // Size of a word in the shared memory region (in bytes)
+    uint32_t align_shift; // log2 of align, word numbers and offsets are converted with shifts
+    RegionConfig config;
+    VersionedLock* orecs; // global table of ownership records (table mode only)
+    size_t orec_mask;
+    uint32_t stripe_shift; // log2 of the number of words per stripe (stripe mode)
+    _Atomic size_t metadata_bytes; // memory used by locks, for statistics
+    const LockScanner* scanner; // batched lock checks, NULL if reads and validation go one word at a time
+    uint64_t uid; // unique among all the regions ever created, so that threads can tell their cached descriptor is stale
+    _Atomic(struct Transaction*) descriptors[MAX_DESCRIPTORS]; // every descriptor created for this region, freed with it
+    atomic_uint num_descriptors;
+    _Atomic uint64_t cm_ticket; // start order of transactions, for the greedy and timestamp policies
+    _Atomic uint32_t serial_token; // id of the irrevocable transaction, 0 if there is none
 }MemoryRegion;
 
-typedef struct LLNode{
-    uint32_t word_num; // word number along with start of the segment gives us all the necessary location
-    void* location; // pointer to the address of the memory location to be written
-    void* value; // pointer to the value written to this memory location
-    struct LLNode* next;
-    SegmentNode* corresponding_segment;
-}LLNode;
+// One entry per run of consecutive words of a segment read by a read-write transaction (by every transaction with
+// the norec engine): a word read right after the previous one extends its run
+typedef struct ReadEntry{
+    SegmentNode* segment;
+    uint32_t word_num; // first word of the run
+    uint32_t count;    // words in the run
+}ReadEntry;
+
+// One entry per run of consecutive words written, their values follow each other in the log's value array
+// (with the etl engine, the values are the ones the words had before the transaction wrote them)
+typedef struct WriteEntry{
+    SegmentNode* segment;
+    uint32_t word_num; // first word of the run
+    uint32_t count;    // words in the run
+    uint32_t value;    // position of the first word's value in the value array
+}WriteEntry;
+
+typedef struct ReadLog{
+    ReadEntry* entries;
+    char* values; // value each word was read with, i-th word at values + i * align (norec engine only)
+    uint32_t size; // entries
+    uint32_t capacity;
+    uint32_t words; // words in all the entries
+    size_t values_capacity; // in bytes
+}ReadLog;
+
+typedef struct WriteLog{
+    WriteEntry* entries;
+    char* values; // value of the i-th word written at values + i * align
+    uint32_t size; // entries
+    uint32_t capacity;
+    uint32_t words; // words in all the entries, i.e. values
+    size_t values_capacity; // in bytes
+    WriteEntry* scratch; // to sort the entries (see sortWrites)
+    uint32_t scratch_capacity;
+}WriteLog;
+
+typedef struct WriteIndexSlot{
+    SegmentNode* segment;
+    uint32_t word_num;
+    uint32_t entry; // position of the word in the write log
+    uint32_t generation; // the slot is only valid if it matches the generation of the index
+}WriteIndexSlot;
+
+// Hash index over the write set, keyed by segment and word
+typedef struct WriteIndex{
+    WriteIndexSlot* slots;
+    uint32_t bits; // the index has 2^bits slots
+    uint32_t generation;
+}WriteIndex;
+
+// Locks acquired at commit, each one appears once even if it covers several written words
+typedef struct LockLog{
+    VersionedLock** locks;
+    uint32_t size;
+    uint32_t capacity;
+}LockLog;
+
+// Segments allocated or freed by a transaction
+typedef struct SegmentLog{
+    SegmentNode** segments;
+    uint32_t size;
+    uint32_t capacity;
+}SegmentLog;
+
+// Read and write sets, reused by the transactions of a thread
+typedef struct TxLogs{
+    ReadLog reads;
+    WriteLog writes;
+    WriteIndex write_index;
+    LockLog held;
+    SegmentLog allocs; // released if the transaction aborts
+    SegmentLog frees; // only released once the transaction commits
+}TxLogs;
+
+// Version chains detached by a commit at version stamp
+typedef struct RetiredVersions{
+    VersionNode* chain;
+    uint64_t stamp;
+}RetiredVersions;
+
+typedef struct VersionLimbo{
+    RetiredVersions* entries;
+    uint32_t size;
+    uint32_t capacity;
+}VersionLimbo;
+
+// Segment freed by a commit at version stamp, released once no running transaction started before it
+typedef struct RetiredSegment{
+    SegmentNode* segment;
+    uint64_t stamp;
+}RetiredSegment;
+
+typedef struct SegmentLimbo{
+    RetiredSegment* entries;
+    uint32_t size;
+    uint32_t capacity;
+}SegmentLimbo;
+
+// Numbers of released segments, reused by the next allocations of the descriptor
+typedef struct SlotCache{
+    size_t* slots;
+    uint32_t size;
+    uint32_t capacity;
+}SlotCache;
+
+// Freed slabs of a descriptor by size class, reused by its next allocations
+typedef struct SegmentPool{
+    SegmentNode* heads[POOL_CLASSES];
+    size_t bytes;
+}SegmentPool;
+
+// Status of a descriptor, see contention.h
+typedef enum TxStatus{
+    TX_IDLE,
+    TX_READ_ONLY,  // read-only transactions hold no lock, they can neither be killed nor hold back the serial token
+    TX_ACTIVE,
+    TX_KILLED,     // aborted by another transaction, it has to release its locks and abort
+    TX_COMMITTING, // holds all its locks and can no longer be killed
+    TX_IRREVOCABLE, // holds the serial token, runs alone among writers and cannot abort on a conflict
+}TxStatus;
+
+typedef struct ContentionState{
+    _Atomic uint32_t status;   // TxStatus, other transactions only ever move it from TX_ACTIVE to TX_KILLED
+    atomic_bool waiting;       // waiting for another transaction to release a lock
+    _Atomic uint64_t priority; // published rank, the higher wins a conflict
+    uint64_t karma;            // work of the aborted attempts of the current transaction
+    uint32_t consecutive_aborts;
+    uint32_t waits;            // conflicts waited on by the current attempt
+    uint32_t spin_limit;       // spins a wait lasts before giving up, adapted to how long owners keep their locks
+    uint32_t seed;             // for the randomized backoff
+}ContentionState;
+
+typedef struct TxStats{
+    uint64_t commits;
+    uint64_t aborts;
+    uint64_t extensions; // successful snapshot extensions
+    uint64_t failed_extensions;
+    uint64_t extension_saves; // commits of transactions that extended their snapshot at least once
+    uint64_t kills; // other transactions aborted by this one
+    uint64_t waits; // conflicts resolved by waiting
+    uint64_t irrevocable; // transactions run irrevocably
+}TxStats;
 
 
+// Transactions descriptors are created once per thread and region, and reset between transactions
 typedef struct Transaction
 {
     MemoryRegion* region;
+    uint32_t id; // position in the region's descriptors + 1
+    atomic_bool in_use; // set while a transaction runs on this descriptor
     bool is_ro;
-    uint32_t rv;
-    // read set
-    uint32_t num_reads; // size of read LL
-    LLNode* read_addresses; // head of read-set addresses
-    // write set
-    uint32_t num_writes; // size of write LL
-    LLNode* write_addresses; // head of write-set addresses (nodes contain value as well)
+    bool extended; // whether rv moved forward since the transaction began
+    uint64_t rv;
+    _Atomic uint64_t active_rv; // published lower bound of rv while the transaction runs, UINT64_MAX otherwise
+    TxLogs logs; // read set and write set (write entries contain value as well)
+    VersionLimbo limbo; // versions detached by our commits, not yet freed
+    SegmentLimbo retired; // segments freed by our commits, not yet released
+    SlotCache free_slots;
+    SegmentPool pool;
+    ContentionState cm;
+    TxStats stats; // accumulated over all the transactions run on this descriptor
     // struct SegmentNode* temp_alloced; // Linked list of alloced segments in current transaction
     BloomFilter* filter;
 }Transaction;
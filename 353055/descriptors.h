@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "data_structures.h"
+#include "bloom_filter.h"
+#include "logs.h"
+#include "multi_version.h"
+#include "reclamation.h"
+#include "contention.h"
+#include "macros.h"
+
+// Each thread caches the descriptor it used last, along with the uid of its region.
+// The uid is compared before the cached pointer is ever dereferenced, since the region (and its descriptors) may be gone.
+// A descriptor is claimed with a CAS on in_use, so a transaction handle stays valid whatever thread ends up using it.
+
+static atomic_ulong next_region_uid = 1;
+static __thread uint64_t cached_region_uid = 0;
+static __thread Transaction* cached_tx = NULL;
+
+Transaction* createDescriptor(MemoryRegion* region){
+    Transaction* t = (Transaction*) calloc(1, sizeof(Transaction));
+    if(unlikely(!t))
+        return NULL;
+    t -> region = region;
+    t -> filter = initialiseBloomFilter();
+    if(unlikely(!(t->filter))){
+        free(t);
+        return NULL;
+    }
+    atomic_init(&(t->in_use), true);
+    atomic_init(&(t->active_rv), UINT64_MAX);
+    atomic_init(&(t->cm.status), TX_IDLE);
+    atomic_init(&(t->cm.waiting), false);
+    atomic_init(&(t->cm.priority), 0);
+    t -> cm.spin_limit = CM_SPINS_PER_WAIT;
+    unsigned int slot = atomic_fetch_add(&(region->num_descriptors), 1);
+    if(unlikely(slot >= MAX_DESCRIPTORS)){
+        atomic_fetch_sub(&(region->num_descriptors), 1);
+        freeBloomFilter(t->filter);
+        free(t);
+        return NULL;
+    }
+    t -> id = slot + 1;
+    atomic_store(&(region->descriptors[slot]), t);
+    return t;
+}
+
+static inline bool claimDescriptor(Transaction* t){
+    bool expected = false;
+    return atomic_compare_exchange_strong_explicit(&(t->in_use), &expected, true, memory_order_acquire, memory_order_relaxed);
+}
+
+// Returns an unused descriptor for the calling thread, preferring the one it used last
+Transaction* acquireDescriptor(MemoryRegion* region){
+    Transaction* t = cached_tx;
+    if(likely(cached_region_uid == region->uid && claimDescriptor(t)))
+        return t;
+    // Either this thread never ran on this region, or its descriptor is busy: reuse any idle one before creating more
+    t = NULL;
+    unsigned int count = atomic_load(&(region->num_descriptors));
+    for(unsigned int i = 0; i < count && i < MAX_DESCRIPTORS; i++){
+        Transaction* candidate = atomic_load(&(region->descriptors[i]));
+        if(candidate && claimDescriptor(candidate)){
+            t = candidate;
+            break;
+        }
+    }
+    if(!t)
+        t = createDescriptor(region);
+    if(likely(t)){
+        cached_region_uid = region->uid;
+        cached_tx = t;
+    }
+    return t;
+}
+
+// Empties the descriptor and makes it available for the next transaction
+void releaseDescriptor(Transaction* t){
+    clearLogs(&(t->logs));
+    clearBloomFilter(t->filter);
+    retireSnapshot(t);
+    if(unlikely(t->retired.size > 0))
+        reclaimSegments(t->region, t);
+    t -> extended = false;
+    atomic_store_explicit(&(t->in_use), false, memory_order_release);
+}
+
+void freeDescriptors(MemoryRegion* region){
+    unsigned int count = atomic_load(&(region->num_descriptors));
+    for(unsigned int i = 0; i < count && i < MAX_DESCRIPTORS; i++){
+        Transaction* t = atomic_load(&(region->descriptors[i]));
+        if(!t)
+            continue;
+        freeLogs(&(t->logs));
+        freeLimbo(t);
+        freeReclamation(t);
+        freePool(t);
+        freeBloomFilter(t->filter);
+        free(t);
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string.h>
+#include <stdatomic.h>
+
+#include "data_structures.h"
+#include "helper_functions.h"
+#include "word_copy.h"
+#include "macros.h"
+
+// Encounter-time locking engine (TM_ENGINE=etl), write-through in the style of TinySTM.
+// A write locks its word on first touch, saves the old value in the write log, which serves as an undo log,
+// and updates memory in place. Reads of a word we hold the lock of go straight to memory, and the commit only
+// has to validate the read set and release the locks with the new version. An abort restores the old values
+// (see undoWrites). Locks are held while the transaction runs, so a transaction killed by the contention
+// manager notices it at its next access.
+
+// Locks the word for the transaction, false if it has to abort
+static bool etlLock(MemoryRegion* region, Transaction* t, VersionedLock* lock, uint64_t current){
+    cmPublish(region, t);
+    while(!tryLock(lock, t->id)){
+        current = sampleLock(lock);
+        if(isLocked(current) && !cmResolve(region, t, lock, current))
+            return false;
+    }
+    if(unlikely(!appendHeldLock(&(t->logs.held), lock))){
+        unlockKeepVersion(lock);
+        return false;
+    }
+    // every word under our locks must be readable at rv, as we read them without any check
+    current = sampleLock(lock);
+    if(lockVersion(current) > t->rv){
+        observeVersion(region, lockVersion(current));
+        if(region->config.extend == EXTEND_NEVER || !extendSnapshot(region, t) || lockVersion(current) > t->rv)
+            return false;
+    }
+    return true;
+}
+
+bool etlWriteWord(MemoryRegion* region, Transaction* t, SegmentNode* segment, size_t word, void* location, const void* value){
+    WriteLog* undo = &(t->logs.writes);
+    VersionedLock* lock = lockFor(region, segment, word);
+    uint64_t current = sampleLock(lock);
+    bool owned = isLocked(current) && lockOwner(current) == t->id;
+    // in word mode owning the lock means the old value is saved, otherwise the lock may be for another word
+    bool saved = owned && (region->config.locks == LOCKS_WORD || lookupWrite(&(t->logs.write_index), segment, (uint32_t)word) >= 0);
+    if(!saved){
+        if(!owned && !etlLock(region, t, lock, current))
+            return false;
+        if(unlikely(!appendWrite(undo, segment, (uint32_t)word, location, region->align)))
+            return false;
+        if(region->config.locks != LOCKS_WORD && unlikely(!indexWrite(&(t->logs.write_index), undo)))
+            return false;
+    }
+    copyWord(location, value, region->align);
+    return true;
+}
+
+// Validates the read set and publishes the writes by releasing the locks at *wv, false if the transaction has to abort
+bool etlCommit(MemoryRegion* region, Transaction* t, uint64_t* wv){
+    if(!cmStartCommit(t))
+        return false;
+    bool skip_validation;
+    *wv = commitVersion(region, t, &skip_validation);
+    if(!skip_validation && !validateReadSet(region, t))
+        return false;
+    releaseLocksWithVersion(&(t->logs.held), *wv);
+    return true;
+}
@@ -6,154 +6,271 @@
 #include "data_structures.h"
 #include "readers_writer.h"
 #include "bloom_filter.h"
+#include "logs.h"
+#include "descriptors.h"
+#include "lock_mapping.h"
+#include "segment_directory.h"
+#include "segment_pool.h"
+#include "contention.h"
+#include "clock.h"
+#include "norec.h"
+#include "vector_scan.h"
 #include "macros.h"
 
-// A bit unsure about this implementation
 size_t segFromWordAddress(char* address_search){
-    uint64_t address_num = (uint64_t)address_search;
-    size_t seg_num = (size_t)(address_num>>48);
-    return seg_num;
+    return segmentNumber(address_search);
 }
 
 
-LLNode* getWriteNode(void* source_address, LLNode* cur_node){
-    while(cur_node){
-        if(cur_node->location == source_address)
-            break;
-        cur_node = cur_node->next;
-    }
-    return cur_node;
-}
-
-void releaseLocks(LLNode* write_node, LLNode* until){
-    // we release a prefix of locks up to until
-    // until can be NULL, which means we have to release all locks
-    LLNode* remove_node = write_node;
-    while(remove_node != until){
-        assert(remove_node);
-        size_t word = remove_node -> word_num;
-        SegmentNode* segment = remove_node -> corresponding_segment;
-        assert(segment);
-        assert(segment->lock_bit);
-        atomic_store(&(segment->lock_bit[word]), 0);
-        remove_node = remove_node -> next;
-    }
+void releaseLocks(LockLog* held){
+    for(uint32_t i = 0; i < held->size; i++)
+        unlockKeepVersion(held->locks[i]);
+    held->size = 0;
 }
 
-bool acquireLocks(LLNode* write_node){
-    LLNode* cur = write_node;
-    bool success = true;
-    while(cur){
-        SegmentNode* segment = cur -> corresponding_segment;
-        size_t word = cur -> word_num;
-        bool expected = false;
-        if(!atomic_compare_exchange_strong(&(segment->lock_bit[word]), &expected, true)){
-            success = false;
-            break;
+// Takes the locks of the write set in its order, sorted by segment and word (see sortWrites), so committers
+// contending for the same words wait for each other in a single order. Waits go through the contention manager.
+bool acquireLocks(MemoryRegion* region, Transaction* t){
+    WriteLog* writes = &(t->logs.writes);
+    LockLog* held = &(t->logs.held);
+    cmPublish(region, t);
+    for(uint32_t i = 0; i < writes->size; i++){
+        WriteEntry* entry = &(writes->entries[i]);
+        for(uint32_t k = 0; k < entry->count; k++){
+            VersionedLock* lock = lockFor(region, entry->segment, entry->word_num + k);
+            uint64_t current = sampleLock(lock);
+            if(isLocked(current) && lockOwner(current) == t->id)
+                continue; // shared with a word we already locked
+            while(!tryLock(lock, t->id)){
+                // the contention manager decides whether to wait for the owner
+                current = sampleLock(lock);
+                if(isLocked(current) && !cmResolve(region, t, lock, current)){
+                    releaseLocks(held);
+                    return false;
+                }
+            }
+            if(unlikely(!appendHeldLock(held, lock))){
+                unlockKeepVersion(lock);
+                releaseLocks(held);
+                return false;
+            }
         }
-        cur = cur -> next;
     }
-    if(!success){
-        releaseLocks(write_node, cur);
+    if(!cmStartCommit(t)){
+        releaseLocks(held); // killed by a transaction that wants one of our locks
+        return false;
     }
-    return success;
+    return true;
 }
 
-void cleanAddresses(LLNode* node, bool is_write){
-    LLNode* cur = node;
-    while(cur){
-        LLNode* nxt = cur -> next;
-        if(is_write)
-            free(cur->value);
-        free(cur);
-        cur = nxt;
+void cleanSegments(MemoryRegion* region){
+    size_t num_allocs = atomic_load(&(region->num_allocs));
+    for(size_t i = 1; i < num_allocs && i < MAX_SEGMENTS; i++){
+        SegmentNode* segment = lookupSegment(region, i);
+        if(segment)
+            freeNode(region, segment);
     }
+    freeDirectory(region);
 }
 
-void cleanSegments(MemoryRegion* region){
-    for(size_t i = 1; i < region->num_allocs; i++){
-        if(region->segments_list[i]){
-            if(region->segments_list[i]->lock_bit)
-                free(region->segments_list[i]->lock_bit);
-            if(region->segments_list[i]->lock_version_number)
-                free(region->segments_list[i]->lock_version_number);
-            if(region->segments_list[i]->segment_start)
-                free(region->segments_list[i]->segment_start);
-            free(region->segments_list[i]);
-        }
+void cleanTransaction(Transaction* t){
+    releaseDescriptor(t);
+}
+
+void commitTransaction(Transaction* t){
+    t->stats.commits++;
+    cmCommit(t->region, t);
+    if(t->extended)
+        t->stats.extension_saves++;
+    cleanTransaction(t);
+}
+
+// Releases the locks, every word written under them gets version wv in the same store
+void releaseLocksWithVersion(LockLog* held, uint64_t wv){
+    for(uint32_t i = 0; i < held->size; i++)
+        unlockWithVersion(held->locks[i], wv);
+    held->size = 0;
+}
+
+// Puts back the old values of the words written in place (etl engine), and releases their locks.
+// The locks get a fresh version rather than their own: a reader that copied one of our values between
+// sampling the lock before we locked it and after we released it must see the lock change.
+void undoWrites(MemoryRegion* region, Transaction* t){
+    LockLog* held = &(t->logs.held);
+    if(held->size == 0)
+        return;
+    WriteLog* undo = &(t->logs.writes);
+    for(uint32_t i = 0; i < undo->size; i++){
+        WriteEntry* entry = &(undo->entries[i]);
+        storeWords(region, entry->segment, entry->word_num, entry->count, writeValue(undo, entry->value, region->align));
     }
-    free(region->segments_list);
+    for(uint32_t i = 0; i < held->size; i++)
+        unlockWithVersion(held->locks[i], freshVersion(region, lockVersion(sampleLock(held->locks[i]))));
+    held->size = 0;
 }
 
-void cleanTransaction(Transaction* t){
-    cleanAddresses(t->read_addresses, false);
-    cleanAddresses(t->write_addresses, true);
-    freeBloomFilter(t->filter);
-    free(t);
+void abortTransaction(Transaction* t){
+    if(t->region->config.engine == ENGINE_ETL)
+        undoWrites(t->region, t);
+    if(unlikely(t->logs.allocs.size > 0))
+        rollbackAllocations(t->region, t); // after the undo, so that no word holds their address any more
+    t->stats.aborts++;
+    cmAbort(t->region, t);
+    cleanTransaction(t);
 }
 
-bool validate(LLNode* read_node, LLNode* write_node, u_int32_t rv){
-    SegmentNode* read_segment = read_node -> corresponding_segment;
-    assert(read_segment);
-    size_t word = read_node -> word_num;
-    if((read_segment->lock_version_number)[word] > rv)
+bool validate(MemoryRegion* region, VersionedLock* read_lock, uint32_t owner, uint64_t rv){
+    uint64_t lock = sampleLock(read_lock);
+    if(lockVersion(lock) > rv){
+        observeVersion(region, lockVersion(lock)); // so that the retry starts past it
         return false;
-    if((read_segment->lock_bit)[word] == 1){
-        // If hasn't been locked by the same transaction then false
-        if(!getWriteNode(read_node->location, write_node))
-            return false;
     }
+    // If hasn't been locked by the same transaction then false
+    // (the lock may cover another word than the ones we wrote, so the owner is what tells)
+    if(isLocked(lock) && lockOwner(lock) != owner)
+        return false;
     
     return true;
 }
 
-void writeToLocations(LLNode* write_node, size_t align, size_t wv){
-    LLNode* cur = write_node;
-    while(cur){
-        memcpy(cur->location, cur->value, align);
-        SegmentNode* segment = cur -> corresponding_segment;
-        size_t word = cur -> word_num;
-        segment->lock_version_number[word] = wv;
-        atomic_store(&(segment->lock_bit[word]), 0); // not really needed to be done atomically
-        cur = cur -> next;
+// Reads words [start_word, start_word + num_words) of a segment with word locks by batches, as long as none of them
+// is newer than rv or locked by another transaction than owner (0 if the transaction holds no lock while it runs):
+// the locks are checked before and after copying the whole batch. Returns the number of words read (and logged if
+// log_reads), the caller reads the others one by one; -1 if the read set could not grow.
+int64_t readWordsBatched(MemoryRegion* region, Transaction* t, SegmentNode* segment, size_t start_word, size_t num_words, char* target, bool log_reads, uint32_t owner){
+    uint64_t sampled[READ_BATCH_WORDS];
+    size_t done = 0;
+    while(num_words - done >= READ_BATCH_MIN){
+        size_t n = num_words - done < READ_BATCH_WORDS ? num_words - done : READ_BATCH_WORDS;
+        VersionedLock* locks = &(segment->locks[start_word + done]);
+        if(!region->scanner->scan(locks, n, t->rv, owner, sampled))
+            break;
+        atomic_thread_fence(memory_order_acquire);
+        char* source = (char*)wordAddress(region, segment, start_word + done);
+        memcpy(target + done * region->align, source, n * region->align);
+        atomic_thread_fence(memory_order_acquire);
+        if(!region->scanner->same(locks, n, sampled))
+            break;
+        if(log_reads && unlikely(!appendReads(&(t->logs.reads), segment, (uint32_t)(start_word + done), (uint32_t)n)))
+            return -1;
+        done += n;
     }
+    return (int64_t)done;
 }
 
-SegmentNode* initNode(MemoryRegion* region, size_t size){
-
-    SegmentNode* s_node = (SegmentNode*) malloc(sizeof(SegmentNode));
-    if(unlikely(!s_node))
-        return NULL;
-    
+// Samples the n locks, all prefetched before the first is sampled so that their misses overlap, and checks them at once
+static bool validateLocks(MemoryRegion* region, Transaction* t, VersionedLock** locks, uint64_t* sampled, uint32_t n){
+    for(uint32_t k = 0; k < n; k++)
+        __builtin_prefetch(locks[k]);
+    for(uint32_t k = 0; k < n; k++)
+        sampled[k] = sampleLock(locks[k]);
+    if(likely(region->scanner->valid(sampled, n, t->rv, t->id)))
+        return true;
+    // again one by one, which tells which version was too recent
+    for(uint32_t k = 0; k < n; k++){
+        if(!validate(region, locks[k], t->id, t->rv))
+            return false;
+    }
+    return true;
+}
 
-    s_node -> prev = NULL;
-    s_node -> next = NULL;
+// Whether nothing the transaction read changed since rv.
+// With word locks, the locks of a long run of words follow each other and are checked in place. The others are
+// gathered by batches of VALIDATE_BATCH locks.
+bool validateReadSet(MemoryRegion* region, Transaction* t){
+    ReadLog* reads = &(t->logs.reads);
+    if(!region->scanner){
+        for(uint32_t i = 0; i < reads->size; i++){
+            ReadEntry* entry = &(reads->entries[i]);
+            for(uint32_t k = 0; k < entry->count; k++){
+                if(!validate(region, lockFor(region, entry->segment, entry->word_num + k), t->id, t->rv))
+                    return false;
+            }
+        }
+        return true;
+    }
+    VersionedLock* locks[VALIDATE_BATCH];
+    uint64_t sampled[VALIDATE_BATCH];
+    uint32_t n = 0;
+    for(uint32_t i = 0; i < reads->size; i++){
+        ReadEntry* entry = &(reads->entries[i]);
+        if(region->config.locks == LOCKS_WORD && entry->count >= READ_BATCH_MIN){
+            VersionedLock* run = &(entry->segment->locks[entry->word_num]);
+            if(likely(region->scanner->valid((const uint64_t*)run, entry->count, t->rv, t->id)))
+                continue;
+            for(uint32_t k = 0; k < entry->count; k++){
+                if(!validate(region, &(run[k]), t->id, t->rv))
+                    return false;
+            }
+            continue;
+        }
+        for(uint32_t k = 0; k < entry->count; k++){
+            locks[n++] = lockFor(region, entry->segment, entry->word_num + k);
+            if(n == VALIDATE_BATCH){
+                if(!validateLocks(region, t, locks, sampled, n))
+                    return false;
+                n = 0;
+            }
+        }
+    }
+    return n == 0 || validateLocks(region, t, locks, sampled, n);
+}
 
-    s_node -> size = size;
-    if(unlikely(posix_memalign(&(s_node->segment_start), region->align, size) != 0)){
-        free(s_node);
-        return NULL;
+// Moves the snapshot of the transaction to the current clock, provided that nothing it has read changed since rv
+bool extendSnapshot(MemoryRegion* region, Transaction* t){
+    uint64_t now = atomic_load(&(region->global_clock));
+    if(!validateReadSet(region, t)){
+        t->stats.failed_extensions++;
+        return false;
     }
-    memset(s_node->segment_start, 0, size); // initialising the segment with 0s
-    // printf("Node Start Address: %p, size: %zu\n", s_node->segment_start, size);
-    s_node -> num_words = size / (region->align);
-
-    s_node -> lock_bit = (atomic_bool*) malloc((s_node->num_words) * sizeof(atomic_bool));
-    if(unlikely(!(s_node->lock_bit))){
-        free(s_node);
-        free(s_node->segment_start);
-        return NULL;
+    t->rv = now;
+    t->extended = true;
+    t->stats.extensions++;
+    return true;
+}
+
+// Saves the values about to be overwritten on the version chains (mv engine), false if out of memory.
+// Failing leaves duplicates of current values in the chains, which readers handle like any other version.
+bool saveVersions(MemoryRegion* region, Transaction* t, uint64_t wv, uint64_t bound){
+    WriteLog* writes = &(t->logs.writes);
+    for(uint32_t i = 0; i < writes->size; i++){
+        WriteEntry* entry = &(writes->entries[i]);
+        for(uint32_t k = 0; k < entry->count; k++){
+            size_t word = entry->word_num + k;
+            if(unlikely(!pushVersion(region, t, entry->segment, word, wordAddress(region, entry->segment, word), wv, bound)))
+                return false;
+        }
     }
-    memset(s_node->lock_bit, 0, (s_node->num_words) * sizeof(atomic_bool)); // lock bits initially set to 0
-    
-    s_node -> lock_version_number = (uint32_t*) malloc((s_node->num_words) * sizeof(uint32_t));
-    if(unlikely(!(s_node->lock_version_number))){
-        free(s_node);
-        free(s_node->segment_start);
-        free(s_node->lock_bit);
-        return NULL;
+    return true;
+}
+
+void writeToLocations(MemoryRegion* region, Transaction* t, uint64_t wv){
+    WriteLog* writes = &(t->logs.writes);
+    for(uint32_t i = 0; i < writes->size; i++){
+        WriteEntry* entry = &(writes->entries[i]);
+        storeWords(region, entry->segment, entry->word_num, entry->count, writeValue(writes, entry->value, region->align));
     }
-    memset(s_node->lock_version_number, 0, (s_node->num_words) * sizeof(uint32_t)); // version is initially set to 0
+    // only once every word is written, since a lock can cover several of them
+    releaseLocksWithVersion(&(t->logs.held), wv);
+}
 
-    return s_node;
+void printStats(MemoryRegion* region){
+    TxStats total = {0, 0, 0, 0, 0, 0, 0, 0};
+    unsigned int count = atomic_load(&(region->num_descriptors));
+    for(unsigned int i = 0; i < count && i < MAX_DESCRIPTORS; i++){
+        Transaction* t = atomic_load(&(region->descriptors[i]));
+        if(!t)
+            continue;
+        total.commits += t->stats.commits;
+        total.aborts += t->stats.aborts;
+        total.extensions += t->stats.extensions;
+        total.failed_extensions += t->stats.failed_extensions;
+        total.extension_saves += t->stats.extension_saves;
+        total.kills += t->stats.kills;
+        total.waits += t->stats.waits;
+        total.irrevocable += t->stats.irrevocable;
+    }
+    fprintf(stderr, "[tm] engine=%s locks=%s simd=%s metadata=%zu bytes commits=%lu aborts=%lu extensions=%lu failed_extensions=%lu saved_by_extension=%lu cm=%s kills=%lu waits=%lu irrevocable=%lu\n", engine_names[region->config.engine], lock_mode_names[region->config.locks], region->scanner ? region->scanner->name : "off", atomic_load(&(region->metadata_bytes)), (unsigned long)total.commits, (unsigned long)total.aborts,
+        (unsigned long)total.extensions, (unsigned long)total.failed_extensions, (unsigned long)total.extension_saves,
+        cm_names[region->config.cm], (unsigned long)total.kills, (unsigned long)total.waits, (unsigned long)total.irrevocable);
 }
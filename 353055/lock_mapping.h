@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "data_structures.h"
+#include "versioned_lock.h"
+#include "config.h"
+#include "word_copy.h"
+#include "macros.h"
+
+// Maps a word of a segment to the versioned lock that protects it, and to its address.
+// Several words may share a lock in the stripe, table and inline modes, so a transaction can meet a lock it already owns.
+// In the inline mode, each cache line of the segment holds its lock and then INLINE_WORDS words, so that the miss
+// that brings a word in also brings in its version; the words of a segment are then not contiguous in memory.
+
+#define INLINE_WORDS ((CACHE_LINE_BYTES - sizeof(VersionedLock)) / sizeof(uint64_t))
+
+// Number of locks a segment of num_words words carries with it
+size_t segmentLockCount(MemoryRegion* region, size_t num_words){
+    switch(region->config.locks){
+        case LOCKS_STRIPE:
+            return (num_words + ((size_t)1 << region->stripe_shift) - 1) >> region->stripe_shift;
+        case LOCKS_INLINE:
+            return (num_words + INLINE_WORDS - 1) / INLINE_WORDS;
+        case LOCKS_TABLE:
+        case LOCKS_NONE:
+            return 0;
+        default:
+            return num_words;
+    }
+}
+
+static inline VersionedLock* lockFor(MemoryRegion* region, SegmentNode* segment, size_t word){
+    switch(region->config.locks){
+        case LOCKS_STRIPE:
+            return &(segment->locks[word >> region->stripe_shift]);
+        case LOCKS_TABLE:{
+            // consecutive words of a segment use consecutive records, segments are spread by their id
+            uint64_t base = (segment->id * 0x9E3779B97F4A7C15ull) >> 32;
+            return &(region->orecs[(base + word) & region->orec_mask]);
+        }
+        case LOCKS_INLINE:
+            return (VersionedLock*)((char*)segment->segment_start + word / INLINE_WORDS * CACHE_LINE_BYTES);
+        default:
+            return &(segment->locks[word]);
+    }
+}
+
+static inline void* wordAddress(MemoryRegion* region, SegmentNode* segment, size_t word){
+    if(region->config.locks == LOCKS_INLINE)
+        return (char*)segment->segment_start + word / INLINE_WORDS * CACHE_LINE_BYTES + sizeof(VersionedLock) + word % INLINE_WORDS * sizeof(uint64_t);
+    return (char*)segment->segment_start + (word << region->align_shift);
+}
+
+// Whether the words of a segment follow each other in memory, i.e. a run of them can be copied at once
+static inline bool wordsContiguous(MemoryRegion* region){
+    return region->config.locks != LOCKS_INLINE;
+}
+
+// Copies count values to the words of a segment from word_num on
+static inline void storeWords(MemoryRegion* region, SegmentNode* segment, size_t word_num, size_t count, const char* values){
+    if(wordsContiguous(region)){
+        memcpy(wordAddress(region, segment, word_num), values, count * region->align);
+        return;
+    }
+    for(size_t k = 0; k < count; k++)
+        copyWord(wordAddress(region, segment, word_num + k), values + k * region->align, region->align);
+}
+
+// Bytes taken by the words of a segment, with their locks in the inline mode
+size_t segmentDataBytes(MemoryRegion* region, size_t num_words){
+    if(region->config.locks == LOCKS_INLINE)
+        return (num_words + INLINE_WORDS - 1) / INLINE_WORDS * CACHE_LINE_BYTES;
+    return num_words * region->align;
+}
+
+// Sets up the lock mapping of a new region, false if the global table could not be allocated
+bool initLockMapping(MemoryRegion* region){
+    if(region->config.locks == LOCKS_INLINE && region->align != sizeof(uint64_t))
+        region -> config.locks = LOCKS_WORD; // a line holds whole words and its lock, only for 8-byte words
+    size_t words_per_stripe = region->align < STRIPE_BYTES ? STRIPE_BYTES / region->align : 1;
+    region -> stripe_shift = (uint32_t)__builtin_ctzl(words_per_stripe);
+    region -> orecs = NULL;
+    region -> orec_mask = 0;
+    if(region->config.locks == LOCKS_TABLE){
+        size_t num_orecs = (size_t)1 << region->config.orec_bits;
+        region -> orecs = (VersionedLock*) calloc(num_orecs, sizeof(VersionedLock));
+        if(unlikely(!(region->orecs)))
+            return false;
+        region -> orec_mask = num_orecs - 1;
+        atomic_fetch_add(&(region->metadata_bytes), num_orecs * sizeof(VersionedLock));
+    }
+    return true;
+}
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "data_structures.h"
+#include "write_index.h"
+#include "word_copy.h"
+#include "macros.h"
+
+// Read and write sets are kept in contiguous arrays that only ever grow.
+// Clearing a log is just resetting its size, so commits and aborts never touch the allocator.
+// The logs belong to a transaction descriptor, which is reused by the transactions of a thread.
+// Entries are runs of consecutive words, so a scan or a wide write takes a single entry.
+
+#define LOG_INITIAL_CAPACITY 64
+
+void clearLogs(TxLogs* logs){
+    logs->reads.size = 0;
+    logs->reads.words = 0;
+    logs->writes.size = 0;
+    logs->writes.words = 0;
+    logs->held.size = 0;
+    logs->allocs.size = 0;
+    logs->frees.size = 0;
+    clearWriteIndex(&(logs->write_index));
+}
+
+void freeLogs(TxLogs* logs){
+    free(logs->reads.entries);
+    free(logs->reads.values);
+    free(logs->writes.entries);
+    free(logs->writes.scratch);
+    free(logs->writes.values);
+    free(logs->write_index.slots);
+    free(logs->held.locks);
+}
+
+// Logs count words read from word_num on
+bool appendReads(ReadLog* log, SegmentNode* segment, uint32_t word_num, uint32_t count){
+    log->words += count;
+    if(log->size > 0){
+        ReadEntry* last = &(log->entries[log->size - 1]);
+        if(last->segment == segment && last->word_num + last->count == word_num){
+            last->count += count;
+            return true;
+        }
+    }
+    if(unlikely(log->size == log->capacity)){
+        uint32_t new_capacity = log->capacity ? 2 * log->capacity : LOG_INITIAL_CAPACITY;
+        ReadEntry* entries = (ReadEntry*) realloc(log->entries, new_capacity * sizeof(ReadEntry));
+        if(unlikely(!entries)){
+            log->words -= count;
+            return false;
+        }
+        log->entries = entries;
+        log->capacity = new_capacity;
+    }
+    ReadEntry* entry = &(log->entries[log->size++]);
+    entry -> segment = segment;
+    entry -> word_num = word_num;
+    entry -> count = count;
+    return true;
+}
+
+static inline bool appendRead(ReadLog* log, SegmentNode* segment, uint32_t word_num){
+    return appendReads(log, segment, word_num, 1);
+}
+
+// Value the i-th word read was read with (norec engine)
+static inline void* readValue(ReadLog* log, uint32_t i, size_t align){
+    return log->values + (size_t)i * align;
+}
+
+bool appendReadValue(ReadLog* log, SegmentNode* segment, uint32_t word_num, const void* value, size_t align){
+    if(unlikely((size_t)(log->words + 1) * align > log->values_capacity)){
+        size_t new_bytes = log->values_capacity ? 2 * log->values_capacity : LOG_INITIAL_CAPACITY * align;
+        char* values = (char*) realloc(log->values, new_bytes);
+        if(unlikely(!values))
+            return false;
+        log->values = values;
+        log->values_capacity = new_bytes;
+    }
+    if(unlikely(!appendRead(log, segment, word_num)))
+        return false;
+    copyWord(readValue(log, log->words - 1, align), value, align);
+    return true;
+}
+
+// Value of the i-th word written
+static inline void* writeValue(WriteLog* log, uint32_t i, size_t align){
+    return log->values + (size_t)i * align;
+}
+
+// Logs a word that is not in the log yet, with its value
+bool appendWrite(WriteLog* log, SegmentNode* segment, uint32_t word_num, const void* value, size_t align){
+    // values are sized separately since the logs may move between regions with different alignments
+    if(unlikely((size_t)(log->words + 1) * align > log->values_capacity)){
+        size_t new_bytes = log->values_capacity ? 2 * log->values_capacity : LOG_INITIAL_CAPACITY * align;
+        char* values = (char*) realloc(log->values, new_bytes);
+        if(unlikely(!values))
+            return false;
+        log->values = values;
+        log->values_capacity = new_bytes;
+    }
+    WriteEntry* last = log->size > 0 ? &(log->entries[log->size - 1]) : NULL;
+    if(last && last->segment == segment && last->word_num + last->count == word_num)
+        last->count++;
+    else{
+        if(unlikely(log->size == log->capacity)){
+            uint32_t new_capacity = log->capacity ? 2 * log->capacity : LOG_INITIAL_CAPACITY;
+            WriteEntry* entries = (WriteEntry*) realloc(log->entries, new_capacity * sizeof(WriteEntry));
+            if(unlikely(!entries))
+                return false;
+            log->entries = entries;
+            log->capacity = new_capacity;
+        }
+        WriteEntry* entry = &(log->entries[log->size++]);
+        entry -> segment = segment;
+        entry -> word_num = word_num;
+        entry -> count = 1;
+        entry -> value = log->words;
+    }
+    copyWord(writeValue(log, log->words, align), value, align);
+    log->words++;
+    return true;
+}
+
+#define WRITE_SORT_INSERTION 32 // shorter write logs are sorted by insertion, longer ones by radix
+
+// Segment number, then word
+static inline uint64_t writeKey(const WriteEntry* entry){
+    return ((uint64_t)entry->segment->id << 32) | entry->word_num;
+}
+
+static void insertionSortWrites(WriteEntry* entries, uint32_t size){
+    for(uint32_t i = 1; i < size; i++){
+        WriteEntry entry = entries[i];
+        uint64_t key = writeKey(&entry);
+        uint32_t j = i;
+        for(; j > 0 && key < writeKey(&(entries[j - 1])); j--)
+            entries[j] = entries[j - 1];
+        entries[j] = entry;
+    }
+}
+
+// Least significant byte first, only on the bytes in which keys differ (few of them: few segments, small offsets)
+static bool radixSortWrites(WriteLog* log){
+    if(unlikely(log->scratch_capacity < log->size)){
+        WriteEntry* scratch = (WriteEntry*) realloc(log->scratch, log->capacity * sizeof(WriteEntry));
+        if(unlikely(!scratch))
+            return false;
+        log->scratch = scratch;
+        log->scratch_capacity = log->capacity;
+    }
+    uint64_t first = writeKey(&(log->entries[0])), differ = 0;
+    for(uint32_t i = 1; i < log->size; i++)
+        differ |= writeKey(&(log->entries[i])) ^ first;
+    WriteEntry* from = log->entries;
+    WriteEntry* to = log->scratch;
+    for(uint32_t shift = 0; shift < 64; shift += 8){
+        if(((differ >> shift) & 0xff) == 0)
+            continue;
+        uint32_t counts[256] = {0};
+        for(uint32_t i = 0; i < log->size; i++)
+            counts[(writeKey(&(from[i])) >> shift) & 0xff]++;
+        uint32_t start = 0;
+        for(uint32_t b = 0; b < 256; b++){
+            uint32_t count = counts[b];
+            counts[b] = start;
+            start += count;
+        }
+        for(uint32_t i = 0; i < log->size; i++)
+            to[counts[(writeKey(&(from[i])) >> shift) & 0xff]++] = from[i];
+        WriteEntry* swap = from;
+        from = to;
+        to = swap;
+    }
+    if(from != log->entries)
+        memcpy(log->entries, from, log->size * sizeof(WriteEntry));
+    return true;
+}
+
+// Orders the runs of the write log by segment and word, so that the commit takes the locks, writes the words and
+// releases the locks in address order. Runs that end up next to each other in memory and in the value array merge.
+// The write index keeps pointing at the same values. False if out of memory.
+bool sortWrites(WriteLog* log){
+    WriteEntry* entries = log->entries;
+    uint32_t i = 1;
+    while(i < log->size && writeKey(&(entries[i - 1])) < writeKey(&(entries[i])))
+        i++;
+    if(i < log->size){
+        if(log->size <= WRITE_SORT_INSERTION)
+            insertionSortWrites(entries, log->size);
+        else if(unlikely(!radixSortWrites(log)))
+            return false;
+    }
+    uint32_t kept = 0;
+    for(i = 0; i < log->size; i++){
+        WriteEntry* last = kept > 0 ? &(entries[kept - 1]) : NULL;
+        if(last && last->segment == entries[i].segment && last->word_num + last->count == entries[i].word_num && last->value + last->count == entries[i].value)
+            last->count += entries[i].count;
+        else
+            entries[kept++] = entries[i];
+    }
+    log->size = kept;
+    return true;
+}
+
+bool appendHeldLock(LockLog* log, VersionedLock* lock){
+    if(unlikely(log->size == log->capacity)){
+        uint32_t new_capacity = log->capacity ? 2 * log->capacity : LOG_INITIAL_CAPACITY;
+        VersionedLock** locks = (VersionedLock**) realloc(log->locks, new_capacity * sizeof(VersionedLock*));
+        if(unlikely(!locks))
+            return false;
+        log->locks = locks;
+        log->capacity = new_capacity;
+    }
+    log->locks[log->size++] = lock;
+    return true;
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "data_structures.h"
+#include "versioned_lock.h"
+#include "lock_mapping.h"
+#include "word_copy.h"
+#include "macros.h"
+
+// Multi-version engine (TM_ENGINE=mv): TL2 for read-write transactions, snapshots for read-only ones.
+// Before a commit overwrites a word, it pushes the old value on the word's version chain, tagged with the
+// interval [valid_from, end) of versions for which it was the current value. A read-only transaction that
+// finds a word newer than its rv walks the chain to the value its snapshot needs, so it never aborts on a conflict.
+//
+// Chains are trimmed by the committers. A version is unneeded once every running transaction has an rv at
+// least as large as its end; those are detached, as well as versions past the chain length bound, and kept in
+// the committer's limbo until no transaction that could still be walking them is running.
+
+#define MV_SPINS_BEFORE_YIELD 64
+
+// Smallest rv a running transaction may still read at, UINT64_MAX if none is running
+uint64_t minActiveRv(MemoryRegion* region){
+    uint64_t bound = UINT64_MAX;
+    unsigned int count = atomic_load(&(region->num_descriptors));
+    for(unsigned int i = 0; i < count && i < MAX_DESCRIPTORS; i++){
+        Transaction* t = atomic_load(&(region->descriptors[i]));
+        if(!t)
+            continue;
+        uint64_t rv = atomic_load(&(t->active_rv));
+        if(rv < bound)
+            bound = rv;
+    }
+    return bound;
+}
+
+// Samples the clock for a new transaction and publishes it, so that committers keep the versions it may need
+uint64_t publishSnapshot(MemoryRegion* region, Transaction* t){
+    // publish first, then sample again: a committer that missed the published value has read the clock before
+    // our second sample, hence only trims versions that ended before our rv
+    atomic_store(&(t->active_rv), atomic_load(&(region->global_clock)));
+    return atomic_load(&(region->global_clock));
+}
+
+void retireSnapshot(Transaction* t){
+    atomic_store_explicit(&(t->active_rv), UINT64_MAX, memory_order_release);
+}
+
+void freeVersionChain(VersionNode* node){
+    while(node){
+        VersionNode* next = atomic_load_explicit(&(node->next), memory_order_relaxed);
+        free(node);
+        node = next;
+    }
+}
+
+// Detached versions wait in the limbo until every transaction that was running when they were detached is over
+bool retireVersions(Transaction* t, VersionNode* chain, uint64_t stamp){
+    VersionLimbo* limbo = &(t->limbo);
+    if(unlikely(limbo->size == limbo->capacity)){
+        uint32_t new_capacity = limbo->capacity ? 2 * limbo->capacity : 16;
+        RetiredVersions* entries = (RetiredVersions*) realloc(limbo->entries, new_capacity * sizeof(RetiredVersions));
+        if(unlikely(!entries))
+            return false;
+        limbo->entries = entries;
+        limbo->capacity = new_capacity;
+    }
+    limbo->entries[limbo->size].chain = chain;
+    limbo->entries[limbo->size].stamp = stamp;
+    limbo->size++;
+    return true;
+}
+
+void reclaimVersions(Transaction* t, uint64_t bound){
+    VersionLimbo* limbo = &(t->limbo);
+    uint32_t kept = 0;
+    for(uint32_t i = 0; i < limbo->size; i++){
+        if(limbo->entries[i].stamp <= bound)
+            freeVersionChain(limbo->entries[i].chain);
+        else
+            limbo->entries[kept++] = limbo->entries[i];
+    }
+    limbo->size = kept;
+}
+
+void freeLimbo(Transaction* t){
+    for(uint32_t i = 0; i < t->limbo.size; i++)
+        freeVersionChain(t->limbo.entries[i].chain);
+    free(t->limbo.entries);
+}
+
+// Saves the current value of a word we hold the lock of, before the commit at wv overwrites it
+bool pushVersion(MemoryRegion* region, Transaction* t, SegmentNode* segment, size_t word, void* location, uint64_t wv, uint64_t bound){
+    VersionNode* node = (VersionNode*) malloc(sizeof(VersionNode) + region->align);
+    if(unlikely(!node))
+        return false;
+    _Atomic(VersionNode*)* head = &(segment->versions[word]);
+    node -> valid_from = lockVersion(sampleLock(lockFor(region, segment, word)));
+    node -> end = wv;
+    copyWord(node->value, location, region->align);
+    atomic_store_explicit(&(node->next), atomic_load_explicit(head, memory_order_relaxed), memory_order_relaxed);
+    atomic_store_explicit(head, node, memory_order_release);
+
+    // Trim the chain, only committers holding the word's lock modify it
+    VersionNode* prev = node;
+    VersionNode* cur = atomic_load_explicit(&(node->next), memory_order_relaxed);
+    uint32_t depth = 1;
+    while(cur && cur->end > bound && depth < region->config.mv_versions){
+        prev = cur;
+        cur = atomic_load_explicit(&(cur->next), memory_order_relaxed);
+        depth++;
+    }
+    // if the limbo cannot grow, the versions simply stay in the chain until a later commit
+    if(cur && likely(retireVersions(t, cur, wv)))
+        atomic_store_explicit(&(prev->next), NULL, memory_order_release);
+    return true;
+}
+
+// Read of one word by a read-only transaction, at its snapshot rv
+bool mvReadWord(MemoryRegion* region, Transaction* t, SegmentNode* segment, size_t word, const void* location, void* target){
+    VersionedLock* lock = lockFor(region, segment, word);
+    uint32_t spins = 0;
+    while(true){
+        uint64_t before = sampleLock(lock);
+        if(isLocked(before)){
+            // the holder is committing, wait for it to either publish or give up
+            if(++spins % MV_SPINS_BEFORE_YIELD == 0)
+                sched_yield();
+            continue;
+        }
+        if(lockVersion(before) <= t->rv){
+            copyWord(target, location, region->align);
+            if(resampleLock(lock) == before)
+                return true;
+            continue;
+        }
+        // The current value is too recent, the acquire load above made the versions pushed by its commit visible
+        VersionNode* node = atomic_load_explicit(&(segment->versions[word]), memory_order_acquire);
+        while(node && node->valid_from > t->rv)
+            node = atomic_load_explicit(&(node->next), memory_order_acquire);
+        if(unlikely(!node))
+            return false; // the version was dropped by the chain length bound
+        copyWord(target, node->value, region->align);
+        return true;
+    }
+}
+
+void freeSegmentVersions(SegmentNode* segment){
+    if(!segment->versions)
+        return;
+    for(uint32_t i = 0; i < segment->num_words; i++)
+        freeVersionChain(atomic_load_explicit(&(segment->versions[i]), memory_order_relaxed));
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "data_structures.h"
+#include "logs.h"
+#include "contention.h"
+#include "word_copy.h"
+#include "macros.h"
+
+// NOrec engine (TM_ENGINE=norec): the global clock is a sequence lock, odd while a writer writes back.
+// There is no per-word metadata. Transactions log the value of every word they read, and whenever the clock
+// moved since their snapshot, they check that memory still holds those values (value-based validation),
+// which moves the snapshot forward. Writers commit one at a time, by taking the sequence lock at their snapshot.
+
+// Waits for no writer to be writing back, and returns the (even) clock
+uint64_t norecSnapshot(MemoryRegion* region){
+    for(uint32_t spins = 1; ; spins++){
+        uint64_t time = atomic_load(&(region->global_clock));
+        if(likely((time & 1) == 0))
+            return time;
+        if(spins % CM_SPINS_BEFORE_YIELD == 0)
+            sched_yield();
+        else
+            cpuRelax();
+    }
+}
+
+// Checks the logged values against memory while no writer writes back, the snapshot then moves to that time
+bool norecValidate(MemoryRegion* region, Transaction* t){
+    ReadLog* reads = &(t->logs.reads);
+    while(true){
+        uint64_t time = norecSnapshot(region);
+        uint32_t value = 0;
+        for(uint32_t i = 0; i < reads->size; i++){
+            // there are no locks, so the words of a run follow each other
+            ReadEntry* entry = &(reads->entries[i]);
+            if(memcmp(wordAddress(region, entry->segment, entry->word_num), readValue(reads, value, region->align), entry->count * region->align) != 0){
+                t->stats.failed_extensions++;
+                return false;
+            }
+            value += entry->count;
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if(atomic_load_explicit(&(region->global_clock), memory_order_relaxed) == time){
+            t->rv = time;
+            t->extended = true;
+            t->stats.extensions++;
+            return true;
+        }
+    }
+}
+
+// Reads a word that is not in the write set, and logs the value read
+bool norecReadWord(MemoryRegion* region, Transaction* t, SegmentNode* segment, size_t word, void* location, void* target){
+    copyWord(target, location, region->align);
+    atomic_thread_fence(memory_order_acquire);
+    // a commit went through since the snapshot, the value may not belong to it
+    while(atomic_load_explicit(&(region->global_clock), memory_order_relaxed) != t->rv){
+        if(!norecValidate(region, t))
+            return false;
+        copyWord(target, location, region->align);
+        atomic_thread_fence(memory_order_acquire);
+    }
+    return appendReadValue(&(t->logs.reads), segment, (uint32_t)word, target, region->align);
+}
+
+// Takes the sequence lock, writes the write set back and releases the lock, false if validation failed
+bool norecCommit(MemoryRegion* region, Transaction* t){
+    uint64_t expected = t->rv;
+    while(!atomic_compare_exchange_strong(&(region->global_clock), &expected, t->rv + 1)){
+        if(!norecValidate(region, t))
+            return false;
+        expected = t->rv;
+    }
+    WriteLog* writes = &(t->logs.writes);
+    for(uint32_t i = 0; i < writes->size; i++){
+        WriteEntry* entry = &(writes->entries[i]);
+        storeWords(region, entry->segment, entry->word_num, entry->count, writeValue(writes, entry->value, region->align));
+    }
+    atomic_store_explicit(&(region->global_clock), t->rv + 2, memory_order_release);
+    return true;
+}
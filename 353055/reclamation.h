@@ -0,0 +1,122 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "data_structures.h"
+#include "segment_directory.h"
+#include "segment_pool.h"
+#include "lock_mapping.h"
+#include "multi_version.h"
+#include "clock.h"
+#include "macros.h"
+
+// An allocation is logged by its transaction, and released right away if the transaction aborts: its address
+// was only ever visible to the transaction (written in its redo log, or in memory under its locks).
+//
+// tm_free only logs the segment. When the transaction commits at version stamp, the segment is retired in its
+// descriptor's limbo, and it stays mapped until no running transaction started before the commit (all of them
+// publish a lower bound of their rv, see publishSnapshot). A transaction that started after the commit read
+// memory in which the segment is no longer reachable. Readers pay nothing for it beyond that publication.
+// The numbers and slabs of released segments are kept by the descriptor and reused by its next allocations.
+
+bool appendSegment(SegmentLog* log, SegmentNode* segment){
+    if(unlikely(log->size == log->capacity)){
+        uint32_t new_capacity = log->capacity ? 2 * log->capacity : 16;
+        SegmentNode** segments = (SegmentNode**) realloc(log->segments, new_capacity * sizeof(SegmentNode*));
+        if(unlikely(!segments))
+            return false;
+        log->segments = segments;
+        log->capacity = new_capacity;
+    }
+    log->segments[log->size++] = segment;
+    return true;
+}
+
+static bool cacheSlot(SlotCache* cache, size_t s_no){
+    if(unlikely(cache->size == cache->capacity)){
+        uint32_t new_capacity = cache->capacity ? 2 * cache->capacity : 16;
+        size_t* slots = (size_t*) realloc(cache->slots, new_capacity * sizeof(size_t));
+        if(unlikely(!slots))
+            return false;
+        cache->slots = slots;
+        cache->capacity = new_capacity;
+    }
+    cache->slots[cache->size++] = s_no;
+    return true;
+}
+
+// Number for a new segment, a released one if the descriptor has any
+size_t reserveSlot(MemoryRegion* region, Transaction* t){
+    if(t && t->free_slots.size > 0)
+        return t->free_slots.slots[--(t->free_slots.size)];
+    return atomic_fetch_add(&(region->num_allocs), 1);
+}
+
+// Moves the segments freed by a transaction that committed at stamp to the limbo, false if out of memory
+// (the segments not retired then simply stay allocated)
+bool retireSegments(Transaction* t, uint64_t stamp){
+    SegmentLog* frees = &(t->logs.frees);
+    SegmentLimbo* limbo = &(t->retired);
+    for(uint32_t i = 0; i < frees->size; i++){
+        if(unlikely(limbo->size == limbo->capacity)){
+            uint32_t new_capacity = limbo->capacity ? 2 * limbo->capacity : 16;
+            RetiredSegment* entries = (RetiredSegment*) realloc(limbo->entries, new_capacity * sizeof(RetiredSegment));
+            if(unlikely(!entries))
+                return false;
+            limbo->entries = entries;
+            limbo->capacity = new_capacity;
+        }
+        limbo->entries[limbo->size].segment = frees->segments[i];
+        limbo->entries[limbo->size].stamp = stamp;
+        limbo->size++;
+    }
+    return true;
+}
+
+// Called when the transaction commits at version stamp, 0 if it committed without writing
+void commitFrees(MemoryRegion* region, Transaction* t, uint64_t stamp){
+    if(likely(t->logs.frees.size == 0))
+        return;
+    if(stamp == 0)
+        stamp = atomic_load(&(region->global_clock)) + 1; // past the rv of every transaction already running
+    observeVersion(region, stamp); // with gv5 and gv6, new transactions must get to the stamp for it to be released
+    retireSegments(t, stamp);
+}
+
+void releaseSegment(MemoryRegion* region, Transaction* t, SegmentNode* segment){
+    size_t s_no = segment->id;
+    unpublishSegment(region, s_no);
+    recycleNode(region, t, segment);
+    cacheSlot(&(t->free_slots), s_no); // if it fails, the number is lost but the memory is not
+}
+
+// Releases the segments allocated by an aborting transaction
+void rollbackAllocations(MemoryRegion* region, Transaction* t){
+    SegmentLog* allocs = &(t->logs.allocs);
+    for(uint32_t i = 0; i < allocs->size; i++)
+        releaseSegment(region, t, allocs->segments[i]);
+    allocs->size = 0;
+}
+
+// Releases the retired segments no running transaction can reach, called once the descriptor's own snapshot is retired
+void reclaimSegments(MemoryRegion* region, Transaction* t){
+    SegmentLimbo* limbo = &(t->retired);
+    uint64_t bound = minActiveRv(region);
+    uint32_t kept = 0;
+    for(uint32_t i = 0; i < limbo->size; i++){
+        if(limbo->entries[i].stamp <= bound)
+            releaseSegment(region, t, limbo->entries[i].segment);
+        else
+            limbo->entries[kept++] = limbo->entries[i];
+    }
+    limbo->size = kept;
+}
+
+// When the region is destroyed, the retired segments are still in the directory and get freed with it
+void freeReclamation(Transaction* t){
+    free(t->logs.allocs.segments);
+    free(t->logs.frees.segments);
+    free(t->retired.entries);
+    free(t->free_slots.slots);
+}
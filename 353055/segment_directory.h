@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "data_structures.h"
+#include "macros.h"
+
+// Addresses handed out to the user are virtual: segment number in the upper bits, byte offset in the segment
+// in the lower SEGMENT_SHIFT bits. The segment number indexes a two-level radix directory, whose leaves are
+// allocated on demand and never move, so readers translate addresses with two loads and no lock while
+// tm_alloc adds segments. A slot is written before the segment's address is given to anyone, and only
+// emptied once no transaction can hold that address any more (see reclamation.h).
+
+static inline size_t segmentNumber(const void* address){
+    return (size_t)((uintptr_t)address >> SEGMENT_SHIFT);
+}
+
+static inline size_t segmentOffset(const void* address){
+    return (size_t)((uintptr_t)address & (((uintptr_t)1 << SEGMENT_SHIFT) - 1));
+}
+
+static inline void* segmentAddress(size_t s_no){
+    return (void*)((uintptr_t)s_no << SEGMENT_SHIFT);
+}
+
+static inline SegmentNode* lookupSegment(MemoryRegion* region, size_t s_no){
+    SegmentSlot* leaf = atomic_load_explicit(&(region->segment_directory[s_no >> DIRECTORY_LEAF_BITS]), memory_order_acquire);
+    if(unlikely(!leaf))
+        return NULL;
+    return atomic_load_explicit(&(leaf[s_no & (DIRECTORY_LEAF_SIZE - 1)]), memory_order_acquire);
+}
+
+// Stores the segment in its (reserved) slot, false if the leaf could not be allocated
+static inline bool publishSegment(MemoryRegion* region, size_t s_no, SegmentNode* segment){
+    _Atomic(SegmentSlot*)* top = &(region->segment_directory[s_no >> DIRECTORY_LEAF_BITS]);
+    SegmentSlot* leaf = atomic_load_explicit(top, memory_order_acquire);
+    if(unlikely(!leaf)){
+        // first segment of this leaf, whoever installs it first wins
+        SegmentSlot* fresh = (SegmentSlot*) calloc(DIRECTORY_LEAF_SIZE, sizeof(SegmentSlot));
+        if(unlikely(!fresh))
+            return false;
+        if(atomic_compare_exchange_strong_explicit(top, &leaf, fresh, memory_order_acq_rel, memory_order_acquire))
+            leaf = fresh;
+        else
+            free(fresh);
+    }
+    atomic_store_explicit(&(leaf[s_no & (DIRECTORY_LEAF_SIZE - 1)]), segment, memory_order_release);
+    return true;
+}
+
+// Empties the slot of a released segment, before its number is reused
+static inline void unpublishSegment(MemoryRegion* region, size_t s_no){
+    SegmentSlot* leaf = atomic_load_explicit(&(region->segment_directory[s_no >> DIRECTORY_LEAF_BITS]), memory_order_acquire);
+    if(likely(leaf))
+        atomic_store_explicit(&(leaf[s_no & (DIRECTORY_LEAF_SIZE - 1)]), NULL, memory_order_release);
+}
+
+static inline void initDirectory(MemoryRegion* region){
+    atomic_init(&(region->num_allocs), 1); // segment 0 is never used, so that no address is NULL
+    for(size_t i = 0; i < DIRECTORY_TOP_SIZE; i++)
+        atomic_init(&(region->segment_directory[i]), NULL);
+}
+
+// Frees the leaves, the segments themselves are freed by the caller
+static inline void freeDirectory(MemoryRegion* region){
+    for(size_t i = 0; i < DIRECTORY_TOP_SIZE; i++)
+        free(atomic_load_explicit(&(region->segment_directory[i]), memory_order_relaxed));
+}
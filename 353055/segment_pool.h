@@ -0,0 +1,130 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "data_structures.h"
+#include "lock_mapping.h"
+#include "multi_version.h"
+#include "macros.h"
+
+// A segment lives in a single slab: its header (SegmentNode), its locks (unless they are inline with its words), its
+// words (aligned to a cache line, or to the region's alignment if larger) and, with the mv engine, the heads of its
+// version chains. Slabs are rounded up to a power of two size class, and a descriptor keeps the slabs its
+// transactions release (up to TM_POOL_BYTES) to serve its next allocations. A new slab comes from calloc, which gets
+// fresh pages already zeroed; a reused one only gets the bytes the new segment uses cleared, when it is handed out.
+
+// Locks of a segment stored apart from its words
+static size_t slabLockCount(MemoryRegion* region, size_t num_words){
+    return region->config.locks == LOCKS_INLINE ? 0 : segmentLockCount(region, num_words);
+}
+
+static size_t slabDataAlign(MemoryRegion* region){
+    return region->align > CACHE_LINE_BYTES ? region->align : CACHE_LINE_BYTES;
+}
+
+// Bytes a slab needs for a segment of size bytes, wherever the allocator places it
+static size_t slabBytes(MemoryRegion* region, size_t size){
+    size_t num_words = size >> region->align_shift;
+    size_t bytes = sizeof(SegmentNode) + slabLockCount(region, num_words) * sizeof(VersionedLock);
+    bytes += slabDataAlign(region) - 1 + segmentDataBytes(region, num_words);
+    if(region->config.engine == ENGINE_MV)
+        bytes += sizeof(void*) - 1 + num_words * sizeof(_Atomic(VersionNode*));
+    return bytes;
+}
+
+static uint8_t sizeClass(size_t bytes){
+    uint32_t shift = POOL_MIN_SHIFT;
+    while(((size_t)1 << shift) < bytes)
+        shift++;
+    return shift - POOL_MIN_SHIFT < POOL_CLASSES ? (uint8_t)(shift - POOL_MIN_SHIFT) : NO_SIZE_CLASS;
+}
+
+static size_t classBytes(uint8_t size_class){
+    return (size_t)1 << (POOL_MIN_SHIFT + size_class);
+}
+
+// Points the header at the parts of the slab, returns the end of the last one
+static char* layoutSlab(MemoryRegion* region, SegmentNode* s_node){
+    char* slab = (char*)s_node;
+    size_t num_locks = slabLockCount(region, s_node->num_words);
+    s_node -> locks = num_locks > 0 ? (VersionedLock*)(slab + sizeof(SegmentNode)) : NULL; // unlocked, version 0
+    uintptr_t data = (uintptr_t)(slab + sizeof(SegmentNode) + num_locks * sizeof(VersionedLock));
+    data = (data + slabDataAlign(region) - 1) & ~(uintptr_t)(slabDataAlign(region) - 1);
+    s_node -> segment_start = (void*)data;
+    char* end = (char*)data + segmentDataBytes(region, s_node->num_words);
+    s_node -> versions = NULL;
+    if(region->config.engine == ENGINE_MV){
+        uintptr_t versions = ((uintptr_t)end + sizeof(void*) - 1) & ~(uintptr_t)(sizeof(void*) - 1);
+        s_node -> versions = (_Atomic(VersionNode*)*)versions;
+        end = (char*)versions + s_node->num_words * sizeof(_Atomic(VersionNode*));
+    }
+    atomic_fetch_add(&(region->metadata_bytes), segmentLockCount(region, s_node->num_words) * sizeof(VersionedLock));
+    return end;
+}
+
+// New zeroed segment of size bytes, from the pool of t if it has a slab of the right class (t may be NULL)
+SegmentNode* initNode(MemoryRegion* region, Transaction* t, size_t size){
+    size_t bytes = slabBytes(region, size);
+    uint8_t size_class = region->config.pool_bytes > 0 ? sizeClass(bytes) : NO_SIZE_CLASS;
+
+    SegmentNode* s_node;
+    bool reused = t && size_class != NO_SIZE_CLASS && t->pool.heads[size_class];
+    if(reused){
+        s_node = t->pool.heads[size_class];
+        t -> pool.heads[size_class] = s_node->next;
+        t -> pool.bytes -= classBytes(size_class);
+    }
+    else{
+        s_node = (SegmentNode*) calloc(1, size_class != NO_SIZE_CLASS ? classBytes(size_class) : bytes);
+        if(unlikely(!s_node))
+            return NULL;
+    }
+
+    s_node -> prev = NULL;
+    s_node -> next = NULL;
+    s_node -> size = size;
+    s_node -> num_words = size >> region->align_shift;
+    s_node -> size_class = size_class;
+    char* end = layoutSlab(region, s_node);
+    if(reused)
+        memset((char*)s_node + sizeof(SegmentNode), 0, end - ((char*)s_node + sizeof(SegmentNode)));
+    return s_node;
+}
+
+// Frees what the segment owns outside of its slab
+static void emptyNode(MemoryRegion* region, SegmentNode* segment){
+    atomic_fetch_sub(&(region->metadata_bytes), segmentLockCount(region, segment->num_words) * sizeof(VersionedLock));
+    freeSegmentVersions(segment);
+}
+
+void freeNode(MemoryRegion* region, SegmentNode* segment){
+    emptyNode(region, segment);
+    free(segment);
+}
+
+// Gives the slab of a segment no transaction can reach any more to the pool of t, or back to the system
+void recycleNode(MemoryRegion* region, Transaction* t, SegmentNode* segment){
+    emptyNode(region, segment);
+    uint8_t size_class = segment->size_class;
+    if(size_class == NO_SIZE_CLASS || t->pool.bytes + classBytes(size_class) > region->config.pool_bytes){
+        free(segment);
+        return;
+    }
+    segment -> next = t->pool.heads[size_class];
+    t -> pool.heads[size_class] = segment;
+    t -> pool.bytes += classBytes(size_class);
+}
+
+void freePool(Transaction* t){
+    for(uint32_t i = 0; i < POOL_CLASSES; i++){
+        while(t->pool.heads[i]){
+            SegmentNode* next = t->pool.heads[i]->next;
+            free(t->pool.heads[i]);
+            t -> pool.heads[i] = next;
+        }
+    }
+    t -> pool.bytes = 0;
+}
@@ -11,6 +11,7 @@
 #include "macros.h"
 #include "tm.h"
 #include "data_structures.h"
+#include "segment_directory.h"
 
 void putVals(shared_t r, tx_t t, void* seg2, void* buffer, size_t size){
     long* buf = (long*)(buffer);
@@ -231,7 +232,7 @@ void two_threads(){
         printf("%ld ", buffer[i]);
     }
     printf("\n");
-    SegmentNode* s = region->segments_list[2];
+    SegmentNode* s = lookupSegment(region, 2);
     for(int i = 0; i < 4; i++){
         long *lptr = (long*)((char*)(s->segment_start) + 8*i);
         // printf("%p holds %ld\n", lptr, *lptr);
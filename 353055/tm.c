@@ -33,8 +33,10 @@
 #include <tm.h>
 #include "data_structures.h"
 #include "helper_functions.h"
+#include "etl.h"
 #include "readers_writer.h"
 #include "bloom_filter.h"
+#include "word_copy.h"
 
 #include "macros.h"
 
@@ -45,30 +47,40 @@
 **/
 shared_t tm_create(size_t size, size_t align) {
     // TODO: tm_create(size_t, size_t)
-    MemoryRegion* region = (MemoryRegion*) malloc(sizeof(MemoryRegion));
-    if (unlikely(!region)) {
-        return invalid_shared;
+    MemoryRegion* region = NULL;
+    if (unlikely(posix_memalign((void**)&region, CACHE_LINE_BYTES, sizeof(MemoryRegion)) != 0)) {
+        return invalid_shared; // aligned, so that the clock has its cache line to itself
     }
-    region -> global_clock = 0;
+    atomic_init(&(region->global_clock), 0);
+    atomic_init(&(region->clock_eager_until), 0);
     region -> size = size;
     region -> align = align;
-    region -> num_allocs = 1;
-    region -> max_size = 1000;
+    region -> align_shift = alignShift(align);
+    initDirectory(region);
+    loadRegionConfig(&(region->config));
+    atomic_init(&(region->metadata_bytes), 0);
+    region -> scanner = selectLockScanner(region->config.simd);
+    if(unlikely(!initLockMapping(region))){
+        free(region);
+        return invalid_shared;
+    }
+    region -> uid = atomic_fetch_add(&next_region_uid, 1);
+    atomic_init(&(region->num_descriptors), 0);
+    atomic_init(&(region->cm_ticket), 0);
+    atomic_init(&(region->serial_token), 0);
+    for(size_t i = 0; i < MAX_DESCRIPTORS; i++)
+        atomic_init(&(region->descriptors[i]), NULL);
 
     // We allocate the shared memory buffer such that its words are correctly aligned
 
-    SegmentNode* first_segment = initNode(region, size);
+    SegmentNode* first_segment = initNode(region, NULL, size);
     if(!first_segment)
         return invalid_shared;
-    // initRWLock(&region->allocation_lock);
-    pthread_mutex_init(&(region->allocation_lock), NULL);
-    region -> segments_list = (SegmentNode**)malloc(region->max_size * sizeof(SegmentNode*));
-    if(unlikely(!(region->segments_list))){
+    first_segment -> id = atomic_fetch_add(&(region->num_allocs), 1);
+    if(unlikely(!publishSegment(region, first_segment->id, first_segment))){
         free(region);
         return invalid_shared;
     }
-    region -> segments_list[region->num_allocs] = first_segment;
-    region -> num_allocs++;
     region -> start_segment = first_segment -> segment_start;
 
     return (shared_t) region;
@@ -81,9 +93,11 @@ void tm_destroy(shared_t shared) {
     // printf("Destroy\n");
     // TODO: tm_destroy(shared_t)
     MemoryRegion *region = (MemoryRegion *)shared;
+    if(region->config.stats)
+        printStats(region);
     cleanSegments(region);
-    pthread_mutex_destroy(&(region->allocation_lock));
-    // destroyRWLock(&region->allocation_lock);
+    freeDescriptors(region);
+    free(region->orecs);
     free(region);
 }
 
@@ -93,7 +107,7 @@ void tm_destroy(shared_t shared) {
 **/
 void* tm_start(shared_t unused(shared)) {
     // TODO: tm_start(shared_t)
-    return (void*)(1ll<<48);
+    return segmentAddress(1);
 }
 
 /** [thread-safe] Return the size (in bytes) of the first allocated segment of the shared memory region.
@@ -124,20 +138,17 @@ tx_t tm_begin(shared_t shared, bool is_ro) {
 
     MemoryRegion* region = (MemoryRegion*) shared;
 
-    // Initialising the transaction
-    Transaction* t = (Transaction*) malloc(sizeof(Transaction));
+    // Initialising the transaction, the thread's descriptor comes with empty read and write sets
+    Transaction* t = acquireDescriptor(region);
     if(unlikely(!t))
         return invalid_tx;
-    t -> region = region;
     t -> is_ro = is_ro;
-    t -> rv = region -> global_clock; // Sampling the global clock for the read phase
-    // the following will update the number of reads and writes as they see them
-    t -> num_reads = 0;
-    t -> num_writes = 0;
-    // the numbers will denote the number of items in the respective linked list, not the actual read/writes of the transaction seen so far
-    t -> read_addresses = NULL;
-    t -> write_addresses = NULL;
-    t -> filter = initialiseBloomFilter(200, 4);
+    cmBegin(region, t); // may wait for an irrevocable transaction, so before sampling the clock
+    // Sampling the global clock for the read phase, once published: freed segments and old versions
+    // (mv engine) are kept as long as a transaction that may reach them runs
+    t -> rv = publishSnapshot(region, t);
+    if(region->config.engine == ENGINE_NOREC)
+        t -> rv = norecSnapshot(region); // no writer may be halfway through its write-back
 
     return (tx_t)t;
 }
@@ -153,45 +164,79 @@ bool tm_end(shared_t shared, tx_t tx) {
     Transaction* t = (Transaction*) tx;
 
     if(t->is_ro){
-        cleanTransaction(t);
+        commitFrees(region, t, 0);
+        commitTransaction(t); // every read was consistent with the (possibly extended) snapshot
         return true;
     }
     
-    if(!(t->write_addresses)){
-        cleanTransaction(t);
+    WriteLog* writes = &(t->logs.writes);
+    if(writes->size == 0){
+        commitFrees(region, t, 0);
+        commitTransaction(t);
         return true; // cannot have a write transaction without any write addresses
     }
 
-    // Remove duplicates if required (current implementation duplicates are never added in the first place)
-    SegmentNode* req_node = t -> write_addresses -> corresponding_segment;
-    assert(req_node);
+    if(region->config.engine == ENGINE_ETL){
+        // the writes are already in place
+        uint64_t wv;
+        if(!etlCommit(region, t, &wv)){
+            abortTransaction(t);
+            return false;
+        }
+        commitFrees(region, t, wv);
+        commitTransaction(t);
+        return true;
+    }
+
+    // Locks taken, words written and locks released in address order
+    if(unlikely(!sortWrites(writes))){
+        abortTransaction(t);
+        return false;
+    }
+
+    if(region->config.engine == ENGINE_NOREC){
+        if(!norecCommit(region, t)){
+            abortTransaction(t);
+            return false;
+        }
+        commitFrees(region, t, t->rv + 2); // the sequence lock's value once released
+        commitTransaction(t);
+        return true;
+    }
+
+    // Duplicates are never added to the write set in the first place
     // Acquire all the locks for the write set
-    LLNode* write_node = t -> write_addresses;
-    assert(write_node);
-    if(!acquireLocks(write_node)){
-        cleanTransaction(t);
+    if(!acquireLocks(region, t)){
+        abortTransaction(t);
         return false;
     }
 
 
-    // Increment and store global clock
-    long wv = atomic_fetch_add(&(region->global_clock), 1);
-    wv++;
+    // Get the write version from the global clock
+    bool skip_validation;
+    uint64_t wv = commitVersion(region, t, &skip_validation);
 
     // Validate the read set
-    // if rv + 1 = wv, we're good
-    if(wv == (t->rv) + 1);
+    // if no commit happened since rv (e.g. rv + 1 = wv with gv1), we're good
+    if(skip_validation);
     else{
         // go to each read memory location, check if the lock is either free or taken by the current transaction and its version number is ≤ rv
-        LLNode* read_node = t -> read_addresses;
-        while(read_node){
-            if(!validate(read_node, t->write_addresses, t->rv)){
-                // release locks
-                releaseLocks(write_node, NULL); // all locks have been acquired if we have reached the validate stage
-                cleanTransaction(t);
-                return false;
-            }
-            read_node = read_node -> next;
+        if(!validateReadSet(region, t)){
+            // release locks
+            releaseLocks(&(t->logs.held)); // all locks have been acquired if we have reached the validate stage
+            abortTransaction(t);
+            return false;
+        }
+    }
+
+    // Keep the values being overwritten for the snapshots that may still need them
+    uint64_t bound = 0;
+    if(region->config.engine == ENGINE_MV){
+        bound = minActiveRv(region);
+        if(unlikely(!saveVersions(region, t, wv, bound))){
+            releaseLocks(&(t->logs.held));
+            abortTransaction(t);
+            return false;
         }
     }
 
@@ -199,9 +244,12 @@ bool tm_end(shared_t shared, tx_t tx) {
     // Set value at shared location to current value
     // Update the version to wv
     // Clear the lock bit
-    writeToLocations(write_node, region->align, wv);
+    writeToLocations(region, t, wv);
+    if(region->config.engine == ENGINE_MV)
+        reclaimVersions(t, bound);
+    commitFrees(region, t, wv);
 
-    cleanTransaction(t);
+    commitTransaction(t);
 
     return true;
 }
@@ -227,74 +275,113 @@ bool tm_read(shared_t shared, tx_t tx, void const* source, size_t size, void* ta
     assert(source == source_bytes);
 
     size_t s_no = segFromWordAddress(source_bytes);
-    SegmentNode* req_node = region->segments_list[s_no];
+    SegmentNode* req_node = lookupSegment(region, s_no);
     assert(req_node);
 
-    uint64_t sno48 = (uint64_t)s_no;
-    size_t diff = source_bytes - (char *)(sno48<<48);
-    source_bytes = (char*)req_node->segment_start + diff;
+    size_t diff = segmentOffset(source_bytes);
     // if(!req_node)
     //     printf("Source Address: %p, added: %p\n", source_bytes, source_bytes+2072);
     // assert(req_node);
-    size_t start_word = diff / (region->align), num_words = size / (region->align);
-    assert(req_node->lock_version_number);
-    assert(req_node->lock_bit);
-    if(t -> is_ro){
+    size_t start_word = diff >> region->align_shift, num_words = size >> region->align_shift;
+    if(t -> is_ro && region->config.engine == ENGINE_MV){
+        // snapshot reads, the transaction only aborts if a version it needs was dropped
         for(size_t i = 0; i < num_words; i++){
-            size_t cur_word = start_word + i;
-            // sample lock bit and version number
-            uint32_t v_before = (req_node->lock_version_number)[cur_word];
-            memcpy(target_bytes, source_bytes, region->align);
-            if(((req_node->lock_bit)[cur_word]) || ((req_node->lock_version_number)[cur_word] != v_before) || ((req_node->lock_version_number)[cur_word] > (t->rv))){
-                cleanTransaction(t);
+            source_bytes = (char*)wordAddress(region, req_node, start_word + i);
+            if(unlikely(!mvReadWord(region, t, req_node, start_word + i, source_bytes, target_bytes))){
+                abortTransaction(t);
                 return false;
             }
-            source_bytes += region->align;
             target_bytes += region->align;
         }
     }
-    else{
+    else if(region->config.engine == ENGINE_NOREC){
         for(size_t i = 0; i < num_words; i++){
             size_t cur_word = start_word + i;
-            
-            // If we have already written at this address
-            uint32_t v_before = (req_node->lock_version_number)[cur_word];
-            bool seen = isInBloomFilter(t->filter, source_bytes);
-            // bool seen = true;
-            if(!seen){
-                memcpy(target_bytes, source_bytes, region->align);
+            source_bytes = (char*)wordAddress(region, req_node, cur_word);
+            int64_t written = -1;
+            if(!(t->is_ro) && isInBloomFilter(t->filter, req_node, cur_word))
+                written = lookupWrite(&(t->logs.write_index), req_node, cur_word);
+            if(written >= 0)
+                copyWord(target_bytes, writeValue(&(t->logs.writes), written, region->align), region->align);
+            else if(unlikely(!norecReadWord(region, t, req_node, cur_word, source_bytes, target_bytes))){
+                abortTransaction(t);
+                return false;
             }
-            else{
-                LLNode* writtenNode = getWriteNode(source_bytes, t->write_addresses); // returns NULL if this address does not exist
-
+            target_bytes += region->align;
+        }
+    }
+    else{
+        bool etl = region->config.engine == ENGINE_ETL;
+        if(etl && unlikely(cmKilled(t))){
+            abortTransaction(t); // and give the locks we hold to the transaction that killed us
+            return false;
+        }
+        // read-only transactions only need a read set to extend their snapshot
+        bool can_extend = region->config.extend == EXTEND_ALL || (!(t->is_ro) && region->config.extend == EXTEND_READ_WRITE);
+        bool log_reads = !(t->is_ro) || can_extend;
+        bool buffered = !(t->is_ro) && !etl; // whether our writes are in the write set rather than in memory
+        size_t i = 0;
+        if(region->scanner && region->config.locks == LOCKS_WORD && num_words >= READ_BATCH_MIN && (!buffered || t->logs.writes.size == 0)){
+            // with etl, the words we hold the lock of are ours: read in the batch, and logged like the others
+            int64_t batched = readWordsBatched(region, t, req_node, start_word, num_words, target_bytes, log_reads, etl ? t->id : 0);
+            if(unlikely(batched < 0)){
+                abortTransaction(t);
+                return false;
+            }
+            i = (size_t)batched;
+            target_bytes += i * region->align;
+        }
+        for(; i < num_words; i++){
+            size_t cur_word = start_word + i;
+            source_bytes = (char*)wordAddress(region, req_node, cur_word);
+            VersionedLock* lock = lockFor(region, req_node, cur_word);
+            bool own = false;
+            while(true){
                 // sample lock bit and version number
-                if(writtenNode){
-                    memcpy(target_bytes, writtenNode->value, region->align);
+                uint64_t before = sampleLock(lock);
+                if(etl && isLocked(before) && lockOwner(before) == t->id){
+                    // nobody else can write under our lock, and it was at most rv when we took it
+                    copyWord(target_bytes, source_bytes, region->align);
+                    own = true;
+                    break;
                 }
-                else{
-                    memcpy(target_bytes, source_bytes, region->align);
+                // If we have already written at this address, the value comes from the write set
+                int64_t written = -1;
+                if(buffered && isInBloomFilter(t->filter, req_node, cur_word))
+                    written = lookupWrite(&(t->logs.write_index), req_node, cur_word); // returns -1 if this address does not exist
+                if(written >= 0)
+                    copyWord(target_bytes, writeValue(&(t->logs.writes), written, region->align), region->align);
+                else
+                    copyWord(target_bytes, source_bytes, region->align);
+
+                uint64_t after = resampleLock(lock);
+                if(isLocked(after)){
+                    // being committed by another transaction
+                    if(cmResolve(region, t, lock, after))
+                        continue;
+                    abortTransaction(t);
+                    return false;
                 }
+                if(after != before)
+                    continue; // a commit went through while we copied, read again
+                if(lockVersion(after) <= t->rv)
+                    break;
+                observeVersion(region, lockVersion(after));
+                // Written after our snapshot: move the snapshot forward if nothing we read has changed since
+                if(!can_extend || !extendSnapshot(region, t) || lockVersion(after) > t->rv){
+                    abortTransaction(t);
+                    return false;
+                }
+                // the word itself is not in the read set yet, it must not have changed during the extension
+                if(resampleLock(lock) == after)
+                    break;
             }
-            
-            if(((req_node->lock_bit)[cur_word]) || ((req_node->lock_version_number)[cur_word] != v_before) || ((req_node->lock_version_number)[cur_word] > (t->rv))){
-                cleanTransaction(t);
-                return false;
-            }
-            // Create a new node for reading the value
-            LLNode* newReadNode = (LLNode*) malloc(sizeof(LLNode));
-            if(unlikely(!newReadNode)){
-                cleanTransaction(t);
+            // Log the read so that it gets validated at commit
+            if(log_reads && !own && unlikely(!appendRead(&(t->logs.reads), req_node, cur_word))){
+                abortTransaction(t);
                 return false;
             }
-            newReadNode -> word_num = cur_word;
-            newReadNode -> location = source_bytes;
-            newReadNode -> corresponding_segment = req_node;
-            newReadNode -> next = t -> read_addresses;
-            t -> read_addresses = newReadNode;
-
-            source_bytes += region->align;
             target_bytes += region->align;
-            
         }
     }
 
@@ -316,80 +403,54 @@ bool tm_write(shared_t shared, tx_t tx, void const* source, size_t size, void* t
     MemoryRegion* region = (MemoryRegion*) shared;
     Transaction* t = (Transaction*) tx;
     
-    // keep inserting write addresses and values to the start
-    // remove duplicates in end, keep the most recent (closer to the start)
-
+    // keep appending write addresses and values to the write log
     // for now, search if the same address already exists before adding every element
 
     const char* source_bytes = (const char*)source;
     char* target_bytes = (char*)target;
 
     size_t s_no = segFromWordAddress(target_bytes);
-    SegmentNode* req_node = region->segments_list[s_no];
+    SegmentNode* req_node = lookupSegment(region, s_no);
     assert(req_node);
 
-    uint64_t sno48 = (uint64_t)s_no;
-    size_t diff = target_bytes - (char *)(sno48<<48);
-    target_bytes = (char*)req_node->segment_start + diff;
-    size_t start_word = diff / (region->align), num_words = size / (region->align);
+    size_t diff = segmentOffset(target_bytes);
+    size_t start_word = diff >> region->align_shift, num_words = size >> region->align_shift;
+    if(region->config.engine == ENGINE_ETL){
+        if(unlikely(cmKilled(t))){
+            abortTransaction(t);
+            return false;
+        }
+        for(size_t i = 0; i < num_words; i++){
+            target_bytes = (char*)wordAddress(region, req_node, start_word + i);
+            if(!etlWriteWord(region, t, req_node, start_word + i, target_bytes, source_bytes)){
+                abortTransaction(t);
+                return false;
+            }
+            source_bytes += region->align;
+        }
+        return true;
+    }
+
+    WriteLog* writes = &(t->logs.writes);
     for(size_t i = 0; i < num_words; i++){
         size_t cur_word = start_word + i;
 
-        bool seen = isInBloomFilter(t->filter, target_bytes);
+        bool seen = isInBloomFilter(t->filter, req_node, cur_word);
         // bool seen = true;
-        if(!seen){
-            // Create a new node for writing the value
-            LLNode* newWriteNode = (LLNode*) malloc(sizeof(LLNode));
-            if(unlikely(!newWriteNode)){
-                cleanTransaction(t);
-                return false;
-            }
-            newWriteNode -> word_num = cur_word;
-            newWriteNode -> location = target_bytes;
-            void* buffer = (void*) malloc(sizeof(region->align));
-            if(unlikely(!buffer)){
-                free(newWriteNode);
-                cleanTransaction(t);
+        int64_t written = seen ? lookupWrite(&(t->logs.write_index), req_node, cur_word) : -1; // returns -1 if this address does not exist
+        // If we have already written at this address
+        if(written >= 0)
+            copyWord(writeValue(writes, written, region->align), source_bytes, region->align);
+        else{
+            // Create a new entry for writing the value
+            if(unlikely(!appendWrite(writes, req_node, cur_word, source_bytes, region->align) || !indexWrite(&(t->logs.write_index), writes))){
+                abortTransaction(t);
                 return false;
             }
-            memcpy(buffer, source_bytes, region->align);
-            newWriteNode -> value = buffer; // storing the value in this buffer
-            newWriteNode -> corresponding_segment = req_node;
-            newWriteNode -> next = t -> write_addresses;
-            t -> write_addresses = newWriteNode;
-            addToBloomFilter(t->filter, target_bytes);
-        }
-        else{
-            LLNode* writtenNode = getWriteNode(target_bytes, t->write_addresses); // returns NULL if this address does not exist
-            // If we have already written at this address
-            if(writtenNode)
-                memcpy(writtenNode -> value, source_bytes, region->align);
-            else{
-                // Create a new node for writing the value
-                LLNode* newWriteNode = (LLNode*) malloc(sizeof(LLNode));
-                if(unlikely(!newWriteNode)){
-                    cleanTransaction(t);
-                    return false;
-                }
-                newWriteNode -> word_num = cur_word;
-                newWriteNode -> location = target_bytes;
-                void* buffer = (void*) malloc(sizeof(region->align));
-                if(unlikely(!buffer)){
-                    free(newWriteNode);
-                    cleanTransaction(t);
-                    return false;
-                }
-                memcpy(buffer, source_bytes, region->align);
-                newWriteNode -> value = buffer; // storing the value in this buffer
-                newWriteNode -> corresponding_segment = req_node;
-                newWriteNode -> next = t -> write_addresses;
-                t -> write_addresses = newWriteNode;
-                addToBloomFilter(t->filter, target_bytes);
-        }
+            addToBloomFilter(t->filter, writes, req_node, cur_word);
         }
 
         source_bytes += region->align;
-        target_bytes += region->align;
     }
 
     return true;
@@ -402,29 +463,29 @@ bool tm_write(shared_t shared, tx_t tx, void const* source, size_t size, void* t
  * @param target Pointer in private memory receiving the address of the first byte of the newly allocated, aligned segment
  * @return Whether the whole transaction can continue (success/nomem), or not (abort_alloc)
 **/
-alloc_t tm_alloc(shared_t shared, tx_t unused(tx), size_t size, void** target) {
+alloc_t tm_alloc(shared_t shared, tx_t tx, size_t size, void** target) {
     // TODO: tm_alloc(shared_t, tx_t, size_t, void**)
 
     MemoryRegion* region = (MemoryRegion*) shared;
+    Transaction* t = (Transaction*) tx;
 
-    SegmentNode* s_node = initNode(region, size);
+    SegmentNode* s_node = initNode(region, t, size);
     if(unlikely(!s_node))
         return nomem_alloc;
 
-    pthread_mutex_lock(&(region->allocation_lock));
-    // since we are told that no segment can be larger than 48 bits, we can just let the last 48 bits represent objects inside a segment
-    uint64_t s_no = (uint64_t)(region->num_allocs);
-    if(region->max_size == region->num_allocs){
-        region->max_size *= 2;
-        region->segments_list = (SegmentNode**)realloc(region->segments_list, region->max_size * sizeof(SegmentNode*));
-        if(unlikely(!region->segments_list))
-            return nomem_alloc;
+    // the lower SEGMENT_SHIFT bits represent offsets inside a segment, the upper ones the segment number
+    size_t s_no = reserveSlot(region, t);
+    s_node -> id = s_no;
+    if(unlikely(s_no >= MAX_SEGMENTS || !publishSegment(region, s_no, s_node))){
+        recycleNode(region, t, s_node);
+        return nomem_alloc;
+    }
+    // released if the transaction aborts
+    if(unlikely(!appendSegment(&(t->logs.allocs), s_node))){
+        releaseSegment(region, t, s_node);
+        return nomem_alloc;
     }
-    region->segments_list[s_no] = s_node;
-    region->num_allocs++;
-    *target = (void*)(s_no<<48); // we can get the segment number by looking at the largest 16 bits
-    // it is assumed that there are going to be ≤ 2^16 total allocs
-    pthread_mutex_unlock(&(region->allocation_lock));
+    *target = segmentAddress(s_no);
 
     return success_alloc;
 }
@@ -435,9 +496,19 @@ alloc_t tm_alloc(shared_t shared, tx_t unused(tx), size_t size, void** target) {
  * @param target Address of the first byte of the previously allocated segment to deallocate
  * @return Whether the whole transaction can continue
 **/
-bool tm_free(shared_t unused(shared), tx_t unused(tx), void* unused(target)) {
+bool tm_free(shared_t shared, tx_t tx, void* target) {
     // TODO: tm_free(shared_t, tx_t, void*)
-    // printf("To deallocate %p\n", target);
+    MemoryRegion* region = (MemoryRegion*) shared;
+    Transaction* t = (Transaction*) tx;
 
+    size_t s_no = segmentNumber(target);
+    SegmentNode* segment = lookupSegment(region, s_no);
+    if(unlikely(s_no == 1 || !segment))
+        return true; // the first segment cannot be freed
+    // the segment is released after the commit, once no transaction can still reach it
+    if(unlikely(!appendSegment(&(t->logs.frees), segment))){
+        abortTransaction(t);
+        return false;
+    }
     return true;
 }
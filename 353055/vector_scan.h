@@ -0,0 +1,169 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "data_structures.h"
+#include "versioned_lock.h"
+#include "macros.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define VECTOR_SCAN_X86
+#endif
+
+// Lock checks of the batched multi-word read path (see readWordsBatched), for a run of consecutive word locks:
+//  - scan: samples the locks into sampled, true if none has a version past rv and none is locked by another
+//    transaction than owner (0 for none: a transaction that holds no lock while it runs)
+//  - same: true if the locks still hold the sampled values
+// and of read set validation (see validateReadSet), on lock words already sampled:
+//  - valid: the same check as scan
+// A lock word carries the id of its owner, so a lock held by the transaction itself is told apart from the others
+// without looking at its write set. A lock word is free or ours and at most rv exactly when its low bits (owner and
+// lock bit) are zero or ours, and it is at most unlockedWord(rv) with all the low bits set. Versions stay below
+// 2^46, so lock words compare the same as signed integers.
+// Every lock is loaded whole (an aligned 8-byte lane), the caller orders the loads against the copy with fences.
+// The implementation is picked once per region (TM_SIMD), from what the CPU supports.
+
+#define READ_BATCH_WORDS 64 // words whose locks are checked at once
+#define READ_BATCH_MIN 4    // shorter runs are read one word at a time
+#define VALIDATE_BATCH 16   // read set entries whose locks are prefetched, then checked at once
+
+#define LOCK_LOW_BITS ((OWNER_MASK << OWNER_SHIFT) | LOCK_BIT) // everything but the version
+
+static inline uint64_t ownedLowBits(uint32_t owner){
+    return ((uint64_t)owner << OWNER_SHIFT) | LOCK_BIT;
+}
+
+static bool validLocksScalar(const uint64_t* sampled, size_t n, uint64_t rv, uint32_t owner){
+    uint64_t limit = unlockedWord(rv) | LOCK_LOW_BITS, mine = ownedLowBits(owner);
+    bool valid = true;
+    for(size_t i = 0; i < n; i++){
+        uint64_t low = sampled[i] & LOCK_LOW_BITS;
+        valid &= sampled[i] <= limit && (low == 0 || low == mine);
+    }
+    return valid;
+}
+
+static bool scanLocksScalar(VersionedLock* locks, size_t n, uint64_t rv, uint32_t owner, uint64_t* sampled){
+    for(size_t i = 0; i < n; i++)
+        sampled[i] = atomic_load_explicit(&(locks[i]), memory_order_relaxed);
+    return validLocksScalar(sampled, n, rv, owner);
+}
+
+static bool sameLocksScalar(VersionedLock* locks, size_t n, const uint64_t* sampled){
+    uint64_t diff = 0;
+    for(size_t i = 0; i < n; i++)
+        diff |= atomic_load_explicit(&(locks[i]), memory_order_relaxed) ^ sampled[i];
+    return diff == 0;
+}
+
+static const LockScanner scalar_scanner = {"scalar", scanLocksScalar, sameLocksScalar, validLocksScalar};
+
+#ifdef VECTOR_SCAN_X86
+
+// Lanes past limit, or locked by another transaction than the one with low bits mine
+__attribute__((target("sse4.2")))
+static inline __m128i badLanesSse(__m128i words, __m128i limit, __m128i mine){
+    __m128i low = _mm_and_si128(words, _mm_set1_epi64x((long long)LOCK_LOW_BITS));
+    __m128i zero = _mm_setzero_si128();
+    __m128i free_or_mine = _mm_or_si128(_mm_cmpeq_epi64(low, zero), _mm_cmpeq_epi64(low, mine));
+    return _mm_or_si128(_mm_cmpgt_epi64(words, limit), _mm_andnot_si128(free_or_mine, _mm_cmpeq_epi64(zero, zero)));
+}
+
+__attribute__((target("sse4.2")))
+static bool scanLocksSse(VersionedLock* locks, size_t n, uint64_t rv, uint32_t owner, uint64_t* sampled){
+    __m128i limit = _mm_set1_epi64x((long long)(unlockedWord(rv) | LOCK_LOW_BITS));
+    __m128i mine = _mm_set1_epi64x((long long)ownedLowBits(owner));
+    __m128i bad = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i + 2 <= n; i += 2){
+        __m128i words = _mm_loadu_si128((const __m128i*)&(locks[i]));
+        _mm_storeu_si128((__m128i*)&(sampled[i]), words);
+        bad = _mm_or_si128(bad, badLanesSse(words, limit, mine));
+    }
+    return _mm_testz_si128(bad, bad) && scanLocksScalar(locks + i, n - i, rv, owner, sampled + i);
+}
+
+__attribute__((target("sse4.2")))
+static bool sameLocksSse(VersionedLock* locks, size_t n, const uint64_t* sampled){
+    __m128i diff = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i + 2 <= n; i += 2)
+        diff = _mm_or_si128(diff, _mm_xor_si128(_mm_loadu_si128((const __m128i*)&(locks[i])), _mm_loadu_si128((const __m128i*)&(sampled[i]))));
+    return _mm_testz_si128(diff, diff) && sameLocksScalar(locks + i, n - i, sampled + i);
+}
+
+__attribute__((target("sse4.2")))
+static bool validLocksSse(const uint64_t* sampled, size_t n, uint64_t rv, uint32_t owner){
+    __m128i limit = _mm_set1_epi64x((long long)(unlockedWord(rv) | LOCK_LOW_BITS));
+    __m128i mine = _mm_set1_epi64x((long long)ownedLowBits(owner));
+    __m128i bad = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i + 2 <= n; i += 2)
+        bad = _mm_or_si128(bad, badLanesSse(_mm_loadu_si128((const __m128i*)&(sampled[i])), limit, mine));
+    return _mm_testz_si128(bad, bad) && validLocksScalar(sampled + i, n - i, rv, owner);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i badLanesAvx2(__m256i words, __m256i limit, __m256i mine){
+    __m256i low = _mm256_and_si256(words, _mm256_set1_epi64x((long long)LOCK_LOW_BITS));
+    __m256i zero = _mm256_setzero_si256();
+    __m256i free_or_mine = _mm256_or_si256(_mm256_cmpeq_epi64(low, zero), _mm256_cmpeq_epi64(low, mine));
+    return _mm256_or_si256(_mm256_cmpgt_epi64(words, limit), _mm256_andnot_si256(free_or_mine, _mm256_cmpeq_epi64(zero, zero)));
+}
+
+__attribute__((target("avx2")))
+static bool scanLocksAvx2(VersionedLock* locks, size_t n, uint64_t rv, uint32_t owner, uint64_t* sampled){
+    __m256i limit = _mm256_set1_epi64x((long long)(unlockedWord(rv) | LOCK_LOW_BITS));
+    __m256i mine = _mm256_set1_epi64x((long long)ownedLowBits(owner));
+    __m256i bad = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4){
+        __m256i words = _mm256_loadu_si256((const __m256i*)&(locks[i]));
+        _mm256_storeu_si256((__m256i*)&(sampled[i]), words);
+        bad = _mm256_or_si256(bad, badLanesAvx2(words, limit, mine));
+    }
+    return _mm256_testz_si256(bad, bad) && scanLocksScalar(locks + i, n - i, rv, owner, sampled + i);
+}
+
+__attribute__((target("avx2")))
+static bool sameLocksAvx2(VersionedLock* locks, size_t n, const uint64_t* sampled){
+    __m256i diff = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+        diff = _mm256_or_si256(diff, _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)&(locks[i])), _mm256_loadu_si256((const __m256i*)&(sampled[i]))));
+    return _mm256_testz_si256(diff, diff) && sameLocksScalar(locks + i, n - i, sampled + i);
+}
+
+__attribute__((target("avx2")))
+static bool validLocksAvx2(const uint64_t* sampled, size_t n, uint64_t rv, uint32_t owner){
+    __m256i limit = _mm256_set1_epi64x((long long)(unlockedWord(rv) | LOCK_LOW_BITS));
+    __m256i mine = _mm256_set1_epi64x((long long)ownedLowBits(owner));
+    __m256i bad = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+        bad = _mm256_or_si256(bad, badLanesAvx2(_mm256_loadu_si256((const __m256i*)&(sampled[i])), limit, mine));
+    return _mm256_testz_si256(bad, bad) && validLocksScalar(sampled + i, n - i, rv, owner);
+}
+
+static const LockScanner sse_scanner = {"sse4.2", scanLocksSse, sameLocksSse, validLocksSse};
+static const LockScanner avx2_scanner = {"avx2", scanLocksAvx2, sameLocksAvx2, validLocksAvx2};
+
+#endif
+
+// Best implementation the CPU supports, up to the requested one; NULL turns the batched path off
+const LockScanner* selectLockScanner(SimdLevel level){
+    if(level == SIMD_OFF)
+        return NULL;
+#ifdef VECTOR_SCAN_X86
+    __builtin_cpu_init();
+    if((level == SIMD_AUTO || level == SIMD_AVX2) && __builtin_cpu_supports("avx2"))
+        return &avx2_scanner;
+    if((level == SIMD_AUTO || level == SIMD_AVX2 || level == SIMD_SSE) && __builtin_cpu_supports("sse4.2"))
+        return &sse_scanner;
+#endif
+    return &scalar_scanner;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// A versioned lock is a single 64-bit word:
+//   bit 0       lock bit
+//   bits 1-16   id of the owning transaction descriptor (meaningful only while locked)
+//   bits 17-63  version, i.e. the global clock value of the last commit that wrote the word
+// Locking keeps the version bits, so a locked word still tells which version it protects.
+// 47 bits of version do not wrap in practice, even at a billion commits per second.
+
+typedef _Atomic uint64_t VersionedLock;
+
+#define LOCK_BIT        1ull
+#define OWNER_SHIFT     1
+#define OWNER_MASK      0xFFFFull
+#define VERSION_SHIFT   17
+
+static inline bool isLocked(uint64_t lock){
+    return lock & LOCK_BIT;
+}
+
+static inline uint32_t lockOwner(uint64_t lock){
+    return (uint32_t)((lock >> OWNER_SHIFT) & OWNER_MASK);
+}
+
+static inline uint64_t lockVersion(uint64_t lock){
+    return lock >> VERSION_SHIFT;
+}
+
+static inline uint64_t unlockedWord(uint64_t version){
+    return version << VERSION_SHIFT;
+}
+
+static inline uint64_t lockedWord(uint64_t lock, uint32_t owner){
+    return (lock & ~((OWNER_MASK << OWNER_SHIFT) | LOCK_BIT)) | ((uint64_t)owner << OWNER_SHIFT) | LOCK_BIT;
+}
+
+static inline uint64_t sampleLock(VersionedLock* lock){
+    return atomic_load_explicit(lock, memory_order_acquire);
+}
+
+// Re-samples a lock after its word has been copied, the fence keeps the copy before the load
+static inline uint64_t resampleLock(VersionedLock* lock){
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(lock, memory_order_relaxed);
+}
+
+// Locks the word if it is unlocked, keeping its version
+static inline bool tryLock(VersionedLock* lock, uint32_t owner){
+    uint64_t expected = atomic_load_explicit(lock, memory_order_relaxed);
+    if(isLocked(expected))
+        return false;
+    return atomic_compare_exchange_strong_explicit(lock, &expected, lockedWord(expected, owner), memory_order_acquire, memory_order_relaxed);
+}
+
+// Unlocks a word we own without changing its version (e.g. on abort)
+static inline void unlockKeepVersion(VersionedLock* lock){
+    uint64_t current = atomic_load_explicit(lock, memory_order_relaxed);
+    atomic_store_explicit(lock, unlockedWord(lockVersion(current)), memory_order_release);
+}
+
+// Publishes a new version of a word we own, unlocking it in the same store
+static inline void unlockWithVersion(VersionedLock* lock, uint64_t version){
+    atomic_store_explicit(lock, unlockedWord(version), memory_order_release);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+// Word copies for the alignments regions use in practice. Each case copies a constant number of bytes, which the
+// compiler turns into one load and one store (or a couple of vector moves), instead of a call to memcpy with a size
+// only known at run time. The switch is on the region's alignment, which never changes, so it is always predicted.
+
+#define COPY_WORD_CASE(bytes) \
+    case bytes: \
+        memcpy(target, source, bytes); \
+        return;
+
+static inline void copyWord(void* restrict target, const void* restrict source, size_t align){
+    switch(align){
+        COPY_WORD_CASE(1)
+        COPY_WORD_CASE(2)
+        COPY_WORD_CASE(4)
+        COPY_WORD_CASE(8)
+        COPY_WORD_CASE(16)
+        COPY_WORD_CASE(64)
+        default:
+            memcpy(target, source, align);
+    }
+}
+
+// log2 of the alignment, a power of 2
+static inline unsigned alignShift(size_t align){
+    return (unsigned)__builtin_ctzll((unsigned long long)align);
+}
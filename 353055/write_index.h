@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "data_structures.h"
+#include "macros.h"
+
+// Open addressing (linear probing) index from (segment, word) to the position of the word's value in the write log.
+// Slots are stamped with a generation so that the index is emptied in O(1) by bumping the generation.
+
+#define WRITE_INDEX_INITIAL_BITS 6
+
+static inline size_t writeIndexSlot(const WriteIndex* index, SegmentNode* segment, uint32_t word_num){
+    uint64_t key = (uint64_t)(uintptr_t)segment + (uint64_t)word_num * 0x9E3779B97F4A7C15ull;
+    return (size_t)((key * 0xBF58476D1CE4E5B9ull) >> (64 - index->bits));
+}
+
+// Returns the position of the word's value in the write log, or -1 if it has not been written
+static inline int64_t lookupWrite(const WriteIndex* index, SegmentNode* segment, uint32_t word_num){
+    if(unlikely(!index->slots))
+        return -1;
+    size_t mask = ((size_t)1 << index->bits) - 1;
+    size_t slot = writeIndexSlot(index, segment, word_num);
+    while(true){
+        const WriteIndexSlot* cur = &(index->slots[slot]);
+        if(cur->generation != index->generation)
+            return -1; // empty slot, the word is not in the write set
+        if(cur->segment == segment && cur->word_num == word_num)
+            return cur->entry;
+        slot = (slot + 1) & mask;
+    }
+}
+
+static inline void placeWrite(WriteIndex* index, SegmentNode* segment, uint32_t word_num, uint32_t entry){
+    size_t mask = ((size_t)1 << index->bits) - 1;
+    size_t slot = writeIndexSlot(index, segment, word_num);
+    while(index->slots[slot].generation == index->generation)
+        slot = (slot + 1) & mask;
+    WriteIndexSlot* cur = &(index->slots[slot]);
+    cur -> segment = segment;
+    cur -> word_num = word_num;
+    cur -> entry = entry;
+    cur -> generation = index->generation;
+}
+
+// Rebuilds the index with twice the slots from the entries of the write log
+bool growWriteIndex(WriteIndex* index, const WriteLog* writes){
+    uint32_t bits = index->slots ? index->bits + 1 : WRITE_INDEX_INITIAL_BITS;
+    WriteIndexSlot* slots = (WriteIndexSlot*) calloc((size_t)1 << bits, sizeof(WriteIndexSlot));
+    if(unlikely(!slots))
+        return false;
+    free(index->slots);
+    index->slots = slots;
+    index->bits = bits;
+    index->generation = 1; // calloc'd slots have generation 0, i.e. are all empty
+    for(uint32_t i = 0; i < writes->size; i++){
+        const WriteEntry* entry = &(writes->entries[i]);
+        for(uint32_t k = 0; k < entry->count; k++)
+            placeWrite(index, entry->segment, entry->word_num + k, entry->value + k);
+    }
+    return true;
+}
+
+// Indexes the last word appended to the write log
+bool indexWrite(WriteIndex* index, const WriteLog* writes){
+    // keep the load factor under 1/2 so that probe sequences stay short
+    if(unlikely(!index->slots || 2 * (size_t)(writes->words) > ((size_t)1 << index->bits)))
+        return growWriteIndex(index, writes); // the rebuild also places the new word
+    const WriteEntry* last = &(writes->entries[writes->size - 1]);
+    placeWrite(index, last->segment, last->word_num + last->count - 1, writes->words - 1);
+    return true;
+}
+
+void clearWriteIndex(WriteIndex* index){
+    index->generation++;
+    if(unlikely(index->generation == 0)){
+        // the generation wrapped around, stale slots could look valid again
+        if(index->slots)
+            memset(index->slots, 0, ((size_t)1 << index->bits) * sizeof(WriteIndexSlot));
+        index->generation = 1;
+    }
+}